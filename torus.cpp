@@ -1,31 +1,323 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
 #include <tuple>
 #include <cmath>
 #include <optional>
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <thread>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <atomic>
+#include <chrono>
+#include <csignal>
 #include <sys/ioctl.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <dlfcn.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TORUS_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define TORUS_NEON 1
+#endif
 
-// params to set
-const float MAJOR_RADIUS = 0.6; // radius of torus
-const float MINOR_RADIUS = 0.2; // radius of inner tube
-const float THETA = 0.1; // radians rotation
-const int NUM_POINTS = 500; // number of points in torus mesh
-const std::string SYMBOLS[4] = {"░", "▒", "▓", "█"};
+// -DTORUS_FIXED_POINT makes the Q16.16 integer rasterizer the default, for boards where float
+// math is slow or emulated. Both are always built, --math picks one at run time.
+#ifdef TORUS_FIXED_POINT
+constexpr bool FIXED_POINT_DEFAULT = true;
+#else
+constexpr bool FIXED_POINT_DEFAULT = false;
+#endif
 
-const float MAX_X_Y = MAJOR_RADIUS + MINOR_RADIUS;
+// The shape and spin defaults, overridable with -D. Building with -DTORUS_FIXED_PARAMS also
+// bakes them in: they become compile-time constants in Params, so every use folds into the
+// instructions, and --theta, --major-radius and --minor-radius are refused.
+#ifndef TORUS_THETA
+#define TORUS_THETA 0.1
+#endif
+#ifndef TORUS_MAJOR_RADIUS
+#define TORUS_MAJOR_RADIUS 0.6
+#endif
+#ifndef TORUS_MINOR_RADIUS
+#define TORUS_MINOR_RADIUS 0.2
+#endif
 
-// rotation matrices, i think we only need the composition of all 3
-const float S = std::sin(static_cast<float>(THETA));
-const float C = std::cos(static_cast<float>(THETA));
-const float   ROT[9] = {
-  C*C,       -C*S,      S,
-  S*C+S*S*C, C*C-S*S*S, -S*C,
-  S*S-C*C*S, S*C+C*S*S, C*C,
+// params to set, the defaults here can be overridden with options or a --config file
+const double SPIN_FPS = 30.0; // theta worth of rotation is applied this many times a second
+
+// ROT is one rotation by angle about a unit axis, so frame n of the animation is exactly
+// ROT^n. Building that from the accumulated angle each frame, instead of multiplying the mesh
+// by ROT in place, stops rounding error from compounding over long runs.
+struct AxisAngle {
+  double axis[3];
+  double angle;
+};
+
+// constexpr stand-ins for std::sin/cos/acos, so a fixed build's spin is worked out by the
+// compiler. Plain series and bisection, they only ever run at compile time or once at start.
+constexpr double cx_sin(double x) {
+  const double two_pi = 2.0 * M_PI;
+  x -= two_pi * static_cast<double>(static_cast<long long>(x / two_pi));
+  if (x > M_PI) x -= two_pi;
+  if (x < -M_PI) x += two_pi;
+  double term = x, sum = x;
+  for (int k = 1; k < 30; k++) {
+    term *= -x * x / ((2 * k) * (2 * k + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+constexpr double cx_cos(double x) {
+  const double two_pi = 2.0 * M_PI;
+  x -= two_pi * static_cast<double>(static_cast<long long>(x / two_pi));
+  double term = 1.0, sum = 1.0;
+  for (int k = 1; k < 30; k++) {
+    term *= -x * x / ((2 * k - 1) * (2 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+// cos falls monotonically over [0, pi], so halving the bracket 64 times pins acos to a few ulp
+constexpr double cx_acos(double v) {
+  double lo = 0.0, hi = M_PI;
+  for (int k = 0; k < 64; k++) {
+    double mid = 0.5 * (lo + hi);
+    if (cx_cos(mid) > v) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+  return 0.5 * (lo + hi);
+}
+
+struct Rotation {
+  double m[9];
+};
+
+// The per-step rotation, Rx(theta) Ry(theta) Rz(theta) multiplied out, from s = sin(theta)
+// and c = cos(theta)
+constexpr Rotation step_rotation(double s, double c) {
+  return Rotation{{
+    c*c,       -c*s,      s,
+    s*c+s*s*c, c*c-s*s*s, -s*c,
+    s*s-c*c*s, s*c+c*s*s, c*c,
+  }};
+}
+
+// rows of unit length, at right angles to each other, and no reflection
+constexpr bool orthonormal(const Rotation &r, double eps = 1e-9) {
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      double dot = r.m[3 * i] * r.m[3 * j] + r.m[3 * i + 1] * r.m[3 * j + 1] + r.m[3 * i + 2] * r.m[3 * j + 2];
+      double want = i == j ? 1.0 : 0.0;
+      if (dot - want > eps || want - dot > eps) return false;
+    }
+  }
+  double det = r.m[0] * (r.m[4] * r.m[8] - r.m[5] * r.m[7]) -
+               r.m[1] * (r.m[3] * r.m[8] - r.m[5] * r.m[6]) +
+               r.m[2] * (r.m[3] * r.m[7] - r.m[4] * r.m[6]);
+  return det - 1.0 < eps && 1.0 - det < eps;
+}
+
+static_assert(orthonormal(step_rotation(cx_sin(TORUS_THETA), cx_cos(TORUS_THETA))),
+              "the step rotation has to be a rotation, or the torus shears as it spins");
+
+// the axis and the angle of a rotation, read off its trace and its antisymmetric part
+constexpr AxisAngle axis_angle_of(const Rotation &r) {
+  const double *d = r.m;
+  double cos_angle = (d[0] + d[4] + d[8] - 1.0) / 2.0;
+  AxisAngle a{{0.0, 0.0, 1.0}, cx_acos(cos_angle < -1.0 ? -1.0 : cos_angle > 1.0 ? 1.0 : cos_angle)};
+  const double k = 2.0 * cx_sin(a.angle);
+  if (k != 0.0) {
+    a.axis[0] = (d[7] - d[5]) / k;
+    a.axis[1] = (d[2] - d[6]) / k;
+    a.axis[2] = (d[3] - d[1]) / k;
+  }
+  return a;
+}
+
+// what picks a point's symbol
+enum class ShadeMode {
+  Depth,   // closer is brighter
+  Lambert, // rotated surface normal against a light direction
+};
+
+// shading is a table lookup, the quantized depth or n.l picks an entry
+constexpr int SHADE_LEVELS = 256;
+const float AMBIENT = 0.08f; // faces turned away from the light still get the darkest symbol
+
+// built-in ramps for --ramp, dark to bright
+const char *const RAMP_NAMES[] = {"blocks", "classic", "shades", "long"};
+const char *const RAMPS[] = {
+  "░▒▓█",
+  ".,-~:;=!*#$@",
+  "·░▒▓█",
+  " .'`^\",:;Il!i><~+_-?][}{1)(|/tfjrxnuvczXYUJCLQ0OZmwqpdbkhao*#MW&8%B@$",
+};
+
+// what one terminal cell of the frame is drawn with
+enum class Glyphs {
+  Cell,      // one sample per cell, shaded from the symbols ramp
+  Braille,   // 2x4 samples per cell as the dots of U+2800..U+28FF
+  HalfBlock, // 1x2 samples per cell as upper/lower half blocks
+};
+
+// samples per cell across and down for each kind of glyph
+inline void subcell_size(Glyphs g, int &across, int &down) {
+  across = g == Glyphs::Braille ? 2 : 1;
+  down = g == Glyphs::Braille ? 4 : g == Glyphs::HalfBlock ? 2 : 1;
+}
+
+// UTF-8 for code point cp, up to U+FFFF
+inline std::string utf8(unsigned cp) {
+  std::string s;
+  if (cp < 0x80) {
+    s += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    s += static_cast<char>(0xc0 | (cp >> 6));
+    s += static_cast<char>(0x80 | (cp & 0x3f));
+  } else {
+    s += static_cast<char>(0xe0 | (cp >> 12));
+    s += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    s += static_cast<char>(0x80 | (cp & 0x3f));
+  }
+  return s;
+}
+
+struct Params {
+#ifdef TORUS_FIXED_PARAMS
+  static constexpr float major_radius = TORUS_MAJOR_RADIUS;
+  static constexpr float minor_radius = TORUS_MINOR_RADIUS;
+  static constexpr float theta = TORUS_THETA;
+  static_assert(minor_radius > 0.0f && minor_radius < major_radius, "the tube has to fit inside the ring");
+#else
+  float major_radius = TORUS_MAJOR_RADIUS; // radius of torus
+  float minor_radius = TORUS_MINOR_RADIUS; // radius of inner tube
+  float theta = TORUS_THETA; // radians rotation
+#endif
+  int num_points = 500; // number of points in torus mesh
+  std::vector<std::string> symbols = {"░", "▒", "▓", "█"};
+  ShadeMode shading = ShadeMode::Depth;
+  float light[3] = {-0.4f, -0.6f, 0.7f}; // towards the light, screen y grows downwards
+  bool backface_cull = false; // skip points whose rotated normal faces away from the viewer
+  bool tile_cull = false; // skip groups of points hidden behind fully covered tiles
+  Glyphs glyphs = Glyphs::Cell;
+  bool perspective = false; // camera projection instead of stretching the torus over the frame
+  float camera_distance = 3.0f; // camera z for --perspective, in units of major + minor radius
+  bool fixed_point = FIXED_POINT_DEFAULT; // rasterize in Q16.16 where the options allow it
+
+  // derived from the above by update(), or by the compiler for a fixed build
+#ifdef TORUS_FIXED_PARAMS
+  static constexpr float max_x_y = major_radius + minor_radius;
+  static constexpr AxisAngle spin = axis_angle_of(step_rotation(cx_sin(theta), cx_cos(theta)));
+  static constexpr float depth_scale = SHADE_LEVELS / (2.0f * max_x_y);
+  static constexpr float depth_bias = SHADE_LEVELS / 2.0f;
+#else
+  float max_x_y;
+  AxisAngle spin;
+  float depth_scale; // z * depth_scale + depth_bias is the table index
+  float depth_bias;
+#endif
+  // shade byte for each quantized level, one spare entry for values that round up to the top
+  std::uint8_t shade_lut[SHADE_LEVELS + 1];
+  // what a frame buffer shade byte n encodes as, glyph_table[n - 1]. Symbols for Glyphs::Cell,
+  // otherwise the shade byte is the mask of lit samples and this is one glyph per mask.
+  std::vector<std::string> glyph_table;
+
+  Params() { update(); }
+
+  void update() {
+#ifndef TORUS_FIXED_PARAMS
+    max_x_y = major_radius + minor_radius;
+    // Rotation keeps |p| <= max_x_y, so z lands inside the table, and n.l lands in [-1, 1] and
+    // uses the same index range. --in-place re-rotates the mesh every frame and lets rounding
+    // drift it past that, so the index is still clamped per point.
+    depth_scale = SHADE_LEVELS / (2.0f * max_x_y);
+    depth_bias = SHADE_LEVELS / 2.0f;
+    spin = axis_angle_of(step_rotation(std::sin(static_cast<double>(theta)),
+                                       std::cos(static_cast<double>(theta))));
+#endif
+
+    float len = std::sqrt(light[0] * light[0] + light[1] * light[1] + light[2] * light[2]);
+    for (float &l : light) l = len > 0.0f ? l / len : 0.0f;
+
+    const int ramp = static_cast<int>(symbols.size());
+    for (int q = 0; q <= SHADE_LEVELS; q++) {
+      float v = static_cast<float>(q) / SHADE_LEVELS; // 0..1
+      if (shading == ShadeMode::Lambert) {
+        float lit = 2.0f * v - 1.0f; // n.l
+        v = AMBIENT + (1.0f - AMBIENT) * std::max(0.0f, lit);
+      }
+      int shade = std::min(ramp - 1, static_cast<int>(v * ramp));
+      shade_lut[q] = static_cast<std::uint8_t>(shade + 1);
+    }
+
+    glyph_table.clear();
+    if (glyphs == Glyphs::Cell) {
+      glyph_table = symbols;
+    } else if (glyphs == Glyphs::Braille) {
+      for (unsigned mask = 1; mask < 256; mask++) glyph_table.push_back(utf8(0x2800 + mask));
+    } else {
+      glyph_table = {"▀", "▄", "█"};
+    }
+  }
+};
+
+// set once by parse_options() before anything else reads it
+Params g_params;
+
+constexpr float IDENTITY[9] = {
+  1, 0, 0,
+  0, 1, 0,
+  0, 0, 1,
 };
 
+// rotation by angle about a unit axis (rodrigues), rounded to float only at the end
+void axis_angle_matrix(const double (&u)[3], double angle, float (&out)[9]) {
+  const double s = std::sin(angle);
+  const double c = std::cos(angle);
+  const double t = 1.0 - c;
+  const double m[9] = {
+    t*u[0]*u[0] + c,      t*u[0]*u[1] - s*u[2], t*u[0]*u[2] + s*u[1],
+    t*u[0]*u[1] + s*u[2], t*u[1]*u[1] + c,      t*u[1]*u[2] - s*u[0],
+    t*u[0]*u[2] - s*u[1], t*u[1]*u[2] + s*u[0], t*u[2]*u[2] + c,
+  };
+  for (int k = 0; k < 9; k++) out[k] = static_cast<float>(m[k]);
+}
+
+// rotation after running for seconds, spin.angle is covered every 1 / SPIN_FPS
+void time_rotation(double seconds, float (&out)[9]) {
+  const double two_pi = 2.0 * M_PI;
+  double angle = std::fmod(seconds * SPIN_FPS * g_params.spin.angle, two_pi);
+  axis_angle_matrix(g_params.spin.axis, angle, out);
+}
+
 inline void clear_screen() {
   std::cout << "\033[2J\033[H";
 }
@@ -36,7 +328,7 @@ inline void print_at_pos(int row, int col, char c) {
 
 // calculate the positive z given x and y, return none if not part of the torus
 std::optional<float> calculate_pos_z(float x, float y) {
-  float inner = std::pow(MINOR_RADIUS, 2.0) - std::pow(sqrt(x*x + y*y) - MAJOR_RADIUS, 2.0);
+  float inner = std::pow(g_params.minor_radius, 2.0) - std::pow(sqrt(x*x + y*y) - g_params.major_radius, 2.0);
   if (inner < 0) {
     return std::nullopt;
   }
@@ -52,11 +344,438 @@ inline float mesh_to_value(int i) {
   return convert_range(
     static_cast<float>(i),
     0.0,
-    NUM_POINTS,
-    -1.0 * MAX_X_Y,
-    MAX_X_Y
+    g_params.num_points,
+    -1.0 * g_params.max_x_y,
+    g_params.max_x_y
   );
-  //return static_cast<float>(i) / static_cast<float>(NUM_POINTS) * 2.0 * MAX_X_Y - MAX_X_Y;
+  //return static_cast<float>(i) / static_cast<float>(num_points) * 2.0 * max_x_y - max_x_y;
+}
+
+// how render_mesh resolves overlapping points
+enum class RenderPath {
+  ZBuffer, // per-cell depth test, the mesh is never reordered
+  Painter, // sort back to front every frame and let later points overwrite
+};
+
+enum class MeshKind {
+  Parametric, // theta/phi walk sized from the terminal, see init_mesh_parametric
+  Grid,       // x/y grid solved for z, see init_mesh
+};
+
+enum class Mode {
+  Live,     // animate on the terminal
+  Bench,    // headless, report timings
+  Headless, // headless, dump frames to --out
+  Serve,    // headless, stream frames to TCP clients
+};
+
+enum class HeadlessFormat {
+  Cast, // asciicast v3, like images/torus.cast
+  Ansi, // the exact byte stream a terminal would get
+  Raw,  // rows * cols shade bytes per frame, 0 empty, n for glyph n of the ramp or sub-cell mask n
+};
+
+// one --viewport output
+struct ViewportSpec {
+  std::string path; // tty, fifo or file, - for stdout
+  int rows = 0; // 0 asks the tty, 80x24 when it isn't one
+  int cols = 0;
+  double phase = 0.0; // turns of rotation ahead of the animation clock
+};
+
+struct Options {
+  RenderPath path = RenderPath::ZBuffer;
+  MeshKind mesh = MeshKind::Parametric;
+  bool sync = false;
+  bool diff = false;
+  bool in_place = false;
+  int threads = 1; // 0 means one per core
+  double fps = 30.0; // 0 means uncapped
+  bool skip_frames = false;
+  bool async = false; // write frames from their own thread while the next one renders
+  bool gpu = false; // rasterize with OpenCL when there's a device for it
+  float density = 1.0f; // parametric samples per direction, relative to hole-free
+  Mode mode = Mode::Live;
+  int frames = 300; // --bench and --headless
+  int rows = 0; // explicit size, 0 asks the terminal (or picks a default off a tty)
+  int cols = 0;
+  HeadlessFormat format = HeadlessFormat::Cast;
+  std::string out_path = "-";
+  bool mirror = false; // store half the torus and mirror it in the raster kernel
+  bool lod = true; // pick the parametric mesh density from the terminal size
+  bool cycle = false; // render one turn up front and replay it
+  std::string cache_path; // where the turn is persisted, implies cycle
+  float aspect = 0.0f; // cell width over height for --perspective, 0 asks the terminal
+  std::vector<ViewportSpec> viewports; // draw to these instead of the terminal
+  int port = 0; // --serve
+  std::string mesh_cache; // directory generated meshes are kept in, empty for none
+  bool stats = false; // status line under the frame
+  std::string kernel; // rotate kernel, empty for the widest the cpu supports
+};
+
+// explicit --size, else the mode's default
+inline void default_size(const Options &opts, int rows, int cols, int &out_rows, int &out_cols) {
+  out_rows = opts.rows > 0 ? opts.rows : rows;
+  out_cols = opts.cols > 0 ? opts.cols : cols;
+}
+
+void print_usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [options]\n"
+            << "  --painter    sort the mesh back to front every frame instead of relying on the z-buffer\n"
+            << "  --sync       wrap each frame in synchronized output (DEC mode 2026)\n"
+            << "  --diff       only send the cells that changed since the previous frame\n"
+            << "  --mesh KIND  parametric (default) or grid\n"
+            << "  --in-place   rotate the mesh in place every frame instead of by the accumulated angle\n"
+            << "  --threads N  rasterize on N threads, 0 for one per core (default 1)\n"
+            << "  --fps N      target frame rate, 0 for uncapped (default 30)\n"
+            << "  --skip-frames  drop frames to catch up when running behind\n"
+            << "  --async      write each frame from a second thread while the next one renders\n"
+            << "  --mirror     store only the z >= 0 half of the mesh and mirror it while rasterizing\n"
+            << "  --no-lod     size the parametric mesh once at start instead of per terminal size\n"
+            << "  --density F  parametric mesh density relative to hole-free (default 1)\n"
+            << "  --bench      run headless and report per-stage timings\n"
+            << "  --headless   render without a terminal and write the frames to --out\n"
+            << "  --frames N   frames to run with --bench or --headless (default 300)\n"
+            << "  --size WxH   frame size, --bench defaults to 200x60 and --headless to 80x24\n"
+            << "  --out PATH   where --headless writes, - for stdout (default)\n"
+            << "  --format F   --headless output: cast (default), ansi or raw\n"
+            << "  --cycle      render one full turn once, then just replay it\n"
+            << "  --cache PATH keep the --cycle frames in PATH and map them on the next start\n"
+            << "  --mesh-cache DIR  keep generated meshes in DIR and map them on the next start\n"
+            << "  --major-radius R  radius of the torus (default 0.6)\n"
+            << "  --minor-radius R  radius of the tube (default 0.2)\n"
+            << "  --theta A    radians of rotation per step (default 0.1)\n"
+            << "  --num-points N  grid samples per side for --mesh grid (default 500)\n"
+            << "  --symbols S  shade ramp from dark to bright, one character each (default ░▒▓█)\n"
+            << "  --ramp NAME  built-in shade ramp: blocks (default), classic, shades or long\n"
+            << "  --shading M  depth (default) or lambert, lit from --light\n"
+            << "  --light X,Y,Z  direction towards the light for --shading lambert\n"
+            << "  --subcell G  draw 2x4 samples per cell as braille, or 1x2 as halfblock (ignores the ramp)\n"
+            << "  --perspective  perspective camera, keeps the torus round on non-square cells\n"
+            << "  --camera D   camera distance for --perspective, in torus radii (default 3)\n"
+            << "  --aspect F   cell width over height, for when the terminal doesn't report it (default 0.5)\n"
+            << "  --math M     rasterize in float or fixed (Q16.16) point, default " << (FIXED_POINT_DEFAULT ? "fixed" : "float") << "\n"
+            << "  --kernel K   rotate with scalar, avx2, avx512 or neon instead of the widest the cpu has\n"
+            << "  --cull       skip points facing away from the viewer\n"
+            << "  --tile-cull  skip groups of points hidden behind fully covered 8x8 tiles\n"
+            << "  --gpu        rasterize on an OpenCL device, on the cpu when there isn't one\n"
+            << "  --serve PORT stream the animation to every client that connects to TCP PORT (80x24 unless --size)\n"
+            << "  --viewport PATH[:WxH[:PHASE]]  draw to PATH as well (repeatable), PHASE in turns ahead\n"
+            << "  --stats      draw frame stats on the bottom line (SIGUSR1 or exit dumps them to stderr)\n"
+            << "  --config F   read options from F, one \"key = value\" per line\n"
+            << "  -h, --help   show this message\n";
+}
+
+// PATH[:WxH[:PHASE]], an empty or missing size asks the tty
+bool parse_viewport(const std::string &s, ViewportSpec &v) {
+  std::size_t size_at = s.find(':');
+  v.path = s.substr(0, size_at);
+  if (v.path.empty()) return false;
+  if (size_at == std::string::npos) return true;
+  std::size_t phase_at = s.find(':', size_at + 1);
+  std::string size = s.substr(size_at + 1, phase_at == std::string::npos ? std::string::npos : phase_at - size_at - 1);
+  if (!size.empty() && (std::sscanf(size.c_str(), "%dx%d", &v.cols, &v.rows) != 2 || v.cols <= 0 || v.rows <= 0)) {
+    return false;
+  }
+  if (phase_at == std::string::npos) return true;
+  char *end = nullptr;
+  v.phase = std::strtod(s.c_str() + phase_at + 1, &end);
+  return end != s.c_str() + phase_at + 1 && *end == '\0';
+}
+
+// split a UTF-8 string into one symbol per code point
+std::vector<std::string> split_symbols(const std::string &s) {
+  std::vector<std::string> out;
+  for (unsigned char ch : s) {
+    if (out.empty() || (ch & 0xc0) != 0x80) out.emplace_back();
+    out.back() += static_cast<char>(ch);
+  }
+  return out;
+}
+
+// Read a config file into option form. Each line is "key = value" or a bare "key" for flags,
+// keys are the long option names without the dashes and # starts a comment.
+bool read_config(const char *path, std::vector<std::string> &args) {
+  FILE *f = std::fopen(path, "r");
+  if (!f) return false;
+  auto trim = [](std::string v) {
+    std::size_t b = v.find_first_not_of(" \t\r\n");
+    std::size_t e = v.find_last_not_of(" \t\r\n");
+    return b == std::string::npos ? std::string() : v.substr(b, e - b + 1);
+  };
+  char buf[1024];
+  while (std::fgets(buf, sizeof(buf), f)) {
+    std::string line = buf;
+    // a # inside a value would break ramps like .,-~:;=!*#$@, so only whole-line comments
+    line = trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    std::size_t eq = line.find('=');
+    args.push_back("--" + trim(line.substr(0, eq)));
+    if (eq != std::string::npos) args.push_back(trim(line.substr(eq + 1)));
+  }
+  std::fclose(f);
+  return true;
+}
+
+float parse_positive(const char *prog, const char *name, const char *value) {
+  float v = static_cast<float>(std::atof(value));
+  if (!(v > 0.0f)) {
+    std::cerr << prog << ": " << name << " must be positive\n";
+    std::exit(1);
+  }
+  return v;
+}
+
+// a whole number of at least 1, anything else (0.5, 12abc, -3) is an error
+int parse_count(const char *prog, const char *name, const char *value) {
+  char *end = nullptr;
+  errno = 0;
+  long v = std::strtol(value, &end, 10);
+  if (end == value || *end != '\0' || errno == ERANGE || v < 1 || v > INT32_MAX) {
+    std::cerr << prog << ": " << name << " wants a whole number of at least 1, got '" << value << "'\n";
+    std::exit(1);
+  }
+  return static_cast<int>(v);
+}
+
+Options parse_options(int argc, char **argv) {
+  Options opts;
+  const char *prog = argv[0];
+  // --config files are spliced in where they appear, so later options still override them
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--config") == 0) {
+      if (i + 1 >= argc) {
+        std::cerr << prog << ": --config wants a file\n";
+        std::exit(1);
+      }
+      if (!read_config(argv[++i], args)) {
+        std::cerr << prog << ": can't read config " << argv[i] << ": " << std::strerror(errno) << "\n";
+        std::exit(1);
+      }
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  const int n = static_cast<int>(args.size());
+  for (int i = 0; i < n; i++) {
+    const char *arg = args[i].c_str();
+    if (std::strcmp(arg, "--painter") == 0) {
+      opts.path = RenderPath::Painter;
+    } else if (std::strcmp(arg, "--sync") == 0) {
+      opts.sync = true;
+    } else if (std::strcmp(arg, "--diff") == 0) {
+      opts.diff = true;
+    } else if (std::strcmp(arg, "--mesh") == 0 && i + 1 < n) {
+      const char *kind = args[++i].c_str();
+      if (std::strcmp(kind, "parametric") == 0) {
+        opts.mesh = MeshKind::Parametric;
+      } else if (std::strcmp(kind, "grid") == 0) {
+        opts.mesh = MeshKind::Grid;
+      } else {
+        std::cerr << prog << ": unknown mesh '" << kind << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--in-place") == 0) {
+      opts.in_place = true;
+    } else if (std::strcmp(arg, "--threads") == 0 && i + 1 < n) {
+      opts.threads = std::atoi(args[++i].c_str());
+      if (opts.threads < 0) {
+        std::cerr << prog << ": --threads must be 0 or more\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--fps") == 0 && i + 1 < n) {
+      opts.fps = std::atof(args[++i].c_str());
+      if (opts.fps < 0.0) {
+        std::cerr << prog << ": --fps must be 0 or more\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--skip-frames") == 0) {
+      opts.skip_frames = true;
+    } else if (std::strcmp(arg, "--async") == 0) {
+      opts.async = true;
+    } else if (std::strcmp(arg, "--gpu") == 0) {
+      opts.gpu = true;
+    } else if (std::strcmp(arg, "--mirror") == 0) {
+      opts.mirror = true;
+    } else if (std::strcmp(arg, "--no-lod") == 0) {
+      opts.lod = false;
+    } else if (std::strcmp(arg, "--density") == 0 && i + 1 < n) {
+      opts.density = static_cast<float>(std::atof(args[++i].c_str()));
+      if (opts.density <= 0.0f) {
+        std::cerr << prog << ": --density must be positive\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--bench") == 0) {
+      opts.mode = Mode::Bench;
+    } else if (std::strcmp(arg, "--headless") == 0) {
+      opts.mode = Mode::Headless;
+    } else if (std::strcmp(arg, "--frames") == 0 && i + 1 < n) {
+      opts.frames = std::max(1, std::atoi(args[++i].c_str()));
+    } else if (std::strcmp(arg, "--out") == 0 && i + 1 < n) {
+      opts.out_path = args[++i].c_str();
+    } else if (std::strcmp(arg, "--format") == 0 && i + 1 < n) {
+      const char *format = args[++i].c_str();
+      if (std::strcmp(format, "cast") == 0) {
+        opts.format = HeadlessFormat::Cast;
+      } else if (std::strcmp(format, "ansi") == 0) {
+        opts.format = HeadlessFormat::Ansi;
+      } else if (std::strcmp(format, "raw") == 0) {
+        opts.format = HeadlessFormat::Raw;
+      } else {
+        std::cerr << prog << ": unknown format '" << format << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--size") == 0 && i + 1 < n) {
+      const char *size = args[++i].c_str();
+      if (std::sscanf(size, "%dx%d", &opts.cols, &opts.rows) != 2 ||
+          opts.cols <= 0 || opts.rows <= 0) {
+        std::cerr << prog << ": --size wants WxH, got '" << size << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--cycle") == 0) {
+      opts.cycle = true;
+    } else if (std::strcmp(arg, "--cache") == 0 && i + 1 < n) {
+      opts.cache_path = args[++i].c_str();
+      opts.cycle = true;
+    } else if (std::strcmp(arg, "--mesh-cache") == 0 && i + 1 < n) {
+      opts.mesh_cache = args[++i];
+#ifdef TORUS_FIXED_PARAMS
+    } else if ((std::strcmp(arg, "--major-radius") == 0 || std::strcmp(arg, "--minor-radius") == 0 ||
+                std::strcmp(arg, "--theta") == 0) && i + 1 < n) {
+      std::cerr << prog << ": " << arg << " is fixed at build time (TORUS_FIXED_PARAMS)\n";
+      std::exit(1);
+#else
+    } else if (std::strcmp(arg, "--major-radius") == 0 && i + 1 < n) {
+      g_params.major_radius = parse_positive(prog, arg, args[++i].c_str());
+    } else if (std::strcmp(arg, "--minor-radius") == 0 && i + 1 < n) {
+      g_params.minor_radius = parse_positive(prog, arg, args[++i].c_str());
+    } else if (std::strcmp(arg, "--theta") == 0 && i + 1 < n) {
+      g_params.theta = parse_positive(prog, arg, args[++i].c_str());
+#endif
+    } else if (std::strcmp(arg, "--num-points") == 0 && i + 1 < n) {
+      g_params.num_points = parse_count(prog, arg, args[++i].c_str());
+    } else if (std::strcmp(arg, "--symbols") == 0 && i + 1 < n) {
+      g_params.symbols = split_symbols(args[++i]);
+      if (g_params.symbols.empty() || g_params.symbols.size() > 255) {
+        std::cerr << prog << ": --symbols wants 1 to 255 characters\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--ramp") == 0 && i + 1 < n) {
+      const char *name = args[++i].c_str();
+      auto it = std::find_if(std::begin(RAMP_NAMES), std::end(RAMP_NAMES),
+                             [&](const char *r) { return std::strcmp(r, name) == 0; });
+      if (it == std::end(RAMP_NAMES)) {
+        std::cerr << prog << ": unknown ramp '" << name << "'\n";
+        std::exit(1);
+      }
+      g_params.symbols = split_symbols(RAMPS[it - std::begin(RAMP_NAMES)]);
+    } else if (std::strcmp(arg, "--shading") == 0 && i + 1 < n) {
+      const char *mode = args[++i].c_str();
+      if (std::strcmp(mode, "depth") == 0) {
+        g_params.shading = ShadeMode::Depth;
+      } else if (std::strcmp(mode, "lambert") == 0) {
+        g_params.shading = ShadeMode::Lambert;
+      } else {
+        std::cerr << prog << ": unknown shading '" << mode << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--light") == 0 && i + 1 < n) {
+      float *l = g_params.light;
+      if (std::sscanf(args[++i].c_str(), "%f,%f,%f", &l[0], &l[1], &l[2]) != 3 ||
+          l[0] * l[0] + l[1] * l[1] + l[2] * l[2] == 0.0f) {
+        std::cerr << prog << ": --light wants a nonzero X,Y,Z\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--subcell") == 0 && i + 1 < n) {
+      const char *glyphs = args[++i].c_str();
+      if (std::strcmp(glyphs, "braille") == 0) {
+        g_params.glyphs = Glyphs::Braille;
+      } else if (std::strcmp(glyphs, "halfblock") == 0) {
+        g_params.glyphs = Glyphs::HalfBlock;
+      } else if (std::strcmp(glyphs, "none") == 0) {
+        g_params.glyphs = Glyphs::Cell;
+      } else {
+        std::cerr << prog << ": unknown sub-cell glyphs '" << glyphs << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--perspective") == 0) {
+      g_params.perspective = true;
+    } else if (std::strcmp(arg, "--camera") == 0 && i + 1 < n) {
+      g_params.camera_distance = parse_positive(prog, arg, args[++i].c_str());
+      if (g_params.camera_distance <= 1.0f) {
+        std::cerr << prog << ": --camera must be more than 1, the camera would be inside the torus\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--aspect") == 0 && i + 1 < n) {
+      opts.aspect = parse_positive(prog, arg, args[++i].c_str());
+    } else if (std::strcmp(arg, "--serve") == 0 && i + 1 < n) {
+      opts.port = std::atoi(args[++i].c_str());
+      if (opts.port <= 0 || opts.port > 65535) {
+        std::cerr << prog << ": --serve wants a port, got '" << args[i] << "'\n";
+        std::exit(1);
+      }
+      opts.mode = Mode::Serve;
+    } else if (std::strcmp(arg, "--viewport") == 0 && i + 1 < n) {
+      ViewportSpec v;
+      if (!parse_viewport(args[++i], v)) {
+        std::cerr << prog << ": --viewport wants PATH[:WxH[:PHASE]], got '" << args[i] << "'\n";
+        std::exit(1);
+      }
+      opts.viewports.push_back(v);
+    } else if (std::strcmp(arg, "--math") == 0 && i + 1 < n) {
+      const char *math = args[++i].c_str();
+      if (std::strcmp(math, "fixed") == 0) {
+        g_params.fixed_point = true;
+      } else if (std::strcmp(math, "float") == 0) {
+        g_params.fixed_point = false;
+      } else {
+        std::cerr << prog << ": unknown math '" << math << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--kernel") == 0 && i + 1 < n) {
+      opts.kernel = args[++i];
+      const char *known[] = {"scalar", "avx2", "avx512", "neon"};
+      if (std::none_of(std::begin(known), std::end(known), [&](const char *k) { return opts.kernel == k; })) {
+        std::cerr << prog << ": unknown kernel '" << opts.kernel << "'\n";
+        std::exit(1);
+      }
+    } else if (std::strcmp(arg, "--stats") == 0) {
+      opts.stats = true;
+    } else if (std::strcmp(arg, "--cull") == 0) {
+      g_params.backface_cull = true;
+    } else if (std::strcmp(arg, "--tile-cull") == 0) {
+      g_params.tile_cull = true;
+    } else if (std::strcmp(arg, "-h") == 0 || std::strcmp(arg, "--help") == 0) {
+      print_usage(prog);
+      std::exit(0);
+    } else if (std::strcmp(arg, "--config") == 0) {
+      // the command line's were spliced in above, so this one came from inside a file
+      std::cerr << prog << ": config files can't include other config files\n";
+      std::exit(1);
+    } else {
+      std::cerr << prog << ": unknown option '" << arg << "'\n";
+      print_usage(prog);
+      std::exit(1);
+    }
+  }
+  if (g_params.minor_radius >= g_params.major_radius) {
+    std::cerr << prog << ": --minor-radius must be smaller than --major-radius\n";
+    std::exit(1);
+  }
+  g_params.update();
+  if (opts.threads == 0) {
+    opts.threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  if (opts.path == RenderPath::Painter) {
+    // the sort needs the rotated z written back into the mesh
+    opts.in_place = true;
+  }
+  if (!opts.viewports.empty() && opts.in_place) {
+    std::cerr << prog << ": --viewport shares one mesh between outputs, it can't be rotated in place\n";
+    std::exit(1);
+  }
+  return opts;
 }
 
 struct Point {
@@ -69,8 +788,155 @@ bool order_points(const Point& a, const Point& b) {
   if (a.z < b.z) {return true;} else {return false;}
 }
 
+// mesh arrays are aligned to a cache line and padded to the widest vector (avx-512 = 16 floats)
+constexpr std::size_t MESH_ALIGN = 64;
+constexpr std::size_t MESH_LANES = 16;
+
+template <typename T>
+struct AlignedAllocator {
+  using value_type = T;
+  AlignedAllocator() = default;
+  template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+  T* allocate(std::size_t n) {
+    return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(MESH_ALIGN)));
+  }
+  void deallocate(T* p, std::size_t) {
+    ::operator delete(p, std::align_val_t(MESH_ALIGN));
+  }
+  template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+  template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+using FloatArray = std::vector<float, AlignedAllocator<float>>;
+using FixedArray = std::vector<std::int32_t, AlignedAllocator<std::int32_t>>;
+
+// Q16.16, 16 integer bits and 16 fraction bits in an int32
+constexpr int FIXED_FRAC = 16;
+constexpr std::int32_t FIXED_ONE = 1 << FIXED_FRAC;
+
+inline std::int32_t to_fixed(float v) {
+  return static_cast<std::int32_t>(std::lround(v * FIXED_ONE));
+}
+
+// Bump allocator for memory that only lives for one frame. Allocating is a pointer bump and
+// reset() drops everything at once. A frame that outgrows the block spills into blocks of
+// its own, and the next reset() swaps them all for one block big enough for that frame, so
+// once the sizes settle a frame never touches the heap. Only for trivially destructible T.
+class FrameArena {
+ public:
+  FrameArena() = default;
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+  ~FrameArena() {
+    release_spills();
+    if (base_) ::operator delete(base_, std::align_val_t(MESH_ALIGN));
+  }
+
+  template <typename T>
+  T *alloc(std::size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value, "nothing in the arena is destroyed");
+    static_assert(alignof(T) <= MESH_ALIGN, "arena blocks are only MESH_ALIGN aligned");
+    const std::size_t bytes = (n * sizeof(T) + MESH_ALIGN - 1) / MESH_ALIGN * MESH_ALIGN;
+    wanted_ += bytes;
+    if (used_ + bytes <= size_) {
+      void *p = base_ + used_;
+      used_ += bytes;
+      return static_cast<T *>(p);
+    }
+    void *p = ::operator new(bytes, std::align_val_t(MESH_ALIGN));
+    spills_.push_back(p);
+    return static_cast<T *>(p);
+  }
+
+  // start a new frame, everything handed out since the last reset is gone
+  void reset() {
+    if (!spills_.empty()) {
+      release_spills();
+      if (base_) ::operator delete(base_, std::align_val_t(MESH_ALIGN));
+      size_ = wanted_;
+      base_ = static_cast<char *>(::operator new(size_, std::align_val_t(MESH_ALIGN)));
+    }
+    used_ = 0;
+    wanted_ = 0;
+  }
+
+ private:
+  void release_spills() {
+    for (void *p : spills_) ::operator delete(p, std::align_val_t(MESH_ALIGN));
+    spills_.clear();
+  }
+
+  char *base_ = nullptr;
+  std::size_t size_ = 0;
+  std::size_t used_ = 0;
+  std::size_t wanted_ = 0; // bytes asked for this frame, spilled or not
+  std::vector<void *> spills_;
+};
+
+// structure-of-arrays mesh, x/y/z live in separate arrays so the rotate kernel can load whole vectors
+struct Mesh {
+  std::size_t count = 0; // real points, the arrays are padded past this with zeros
+  // only the z >= 0 half is stored, each point also stands for its mirror (x, y, -z)
+  bool mirrored = false;
+  FloatArray x;
+  FloatArray y;
+  FloatArray z;
+  // unit surface normals, same layout as the positions
+  FloatArray nx;
+  FloatArray ny;
+  FloatArray nz;
+  // Q16.16 copies of all six for the fixed-point rasterizer, see quantize()
+  FixedArray qx;
+  FixedArray qy;
+  FixedArray qz;
+  FixedArray qnx;
+  FixedArray qny;
+  FixedArray qnz;
+
+  std::size_t padded() const { return x.size(); }
+
+  // fill the fixed-point copies, once, the float arrays must not change afterwards. Positions
+  // are stored over max_x_y (FixedMath::unit()) so their precision doesn't depend on the radii.
+  void quantize() {
+    if (qx.size() == padded()) return;
+    const FloatArray *src[] = {&x, &y, &z, &nx, &ny, &nz};
+    FixedArray *dst[] = {&qx, &qy, &qz, &qnx, &qny, &qnz};
+    const float inv_unit = 1.0f / g_params.max_x_y;
+    for (int a = 0; a < 6; a++) {
+      const float scale = a < 3 ? inv_unit : 1.0f;
+      dst[a]->resize(padded());
+      for (std::size_t i = 0; i < padded(); i++) (*dst[a])[i] = to_fixed((*src[a])[i] * scale);
+    }
+  }
+
+  void reserve(std::size_t n) {
+    for (FloatArray *a : {&x, &y, &z, &nx, &ny, &nz}) a->reserve(n + MESH_LANES);
+  }
+
+  void push_back(const Point &p, const Point &n) {
+    x.push_back(p.x);
+    y.push_back(p.y);
+    z.push_back(p.z);
+    nx.push_back(n.x);
+    ny.push_back(n.y);
+    nz.push_back(n.z);
+    count++;
+  }
+
+  // round storage up to a multiple of MESH_LANES, call once after the last push_back
+  void pad() {
+    std::size_t n = (count + MESH_LANES - 1) / MESH_LANES * MESH_LANES;
+    for (FloatArray *a : {&x, &y, &z, &nx, &ny, &nz}) a->resize(n, 0.0f);
+  }
+
+  Point at(std::size_t i) const { return Point{x[i], y[i], z[i]}; }
+  Point normal(std::size_t i) const { return Point{nx[i], ny[i], nz[i]}; }
+
+  // surface points this mesh puts on screen, counting mirrors
+  std::size_t drawn() const { return mirrored ? 2 * count : count; }
+};
 
-inline Point rotate_point(Point &point, const float (&arr)[9]) {
+inline Point rotate_point(const Point &point, const float (&arr)[9]) {
   Point p;
   p.x = point.x * arr[0] + point.y * arr[1] + point.z * arr[2];
   p.y = point.x * arr[3] + point.y * arr[4] + point.z * arr[5];
@@ -78,16 +944,169 @@ inline Point rotate_point(Point &point, const float (&arr)[9]) {
   return p;
 }
 
-void rotate_mesh(std::vector<Point> &points) {
-  for (Point& p1 : points) {
-    p1 = rotate_point(p1, ROT);
+// rotate n points (n a multiple of MESH_LANES) from src into dst, src and dst may be the same arrays
+using RotateKernel = void (*)(const float *sx, const float *sy, const float *sz,
+                              float *dx, float *dy, float *dz,
+                              std::size_t n, const float (&m)[9]);
+
+void rotate_scalar(const float *sx, const float *sy, const float *sz,
+                   float *dx, float *dy, float *dz,
+                   std::size_t n, const float (&m)[9]) {
+  for (std::size_t i = 0; i < n; i++) {
+    Point p = rotate_point(Point{sx[i], sy[i], sz[i]}, m);
+    dx[i] = p.x;
+    dy[i] = p.y;
+    dz[i] = p.z;
+  }
+}
+
+#if defined(TORUS_X86)
+__attribute__((target("avx2,fma")))
+void rotate_avx2(const float *sx, const float *sy, const float *sz,
+                 float *dx, float *dy, float *dz,
+                 std::size_t n, const float (&m)[9]) {
+  __m256 r[9];
+  for (int k = 0; k < 9; k++) r[k] = _mm256_set1_ps(m[k]);
+  for (std::size_t i = 0; i < n; i += 8) {
+    __m256 x = _mm256_load_ps(sx + i);
+    __m256 y = _mm256_load_ps(sy + i);
+    __m256 z = _mm256_load_ps(sz + i);
+    __m256 nx = _mm256_fmadd_ps(z, r[2], _mm256_fmadd_ps(y, r[1], _mm256_mul_ps(x, r[0])));
+    __m256 ny = _mm256_fmadd_ps(z, r[5], _mm256_fmadd_ps(y, r[4], _mm256_mul_ps(x, r[3])));
+    __m256 nz = _mm256_fmadd_ps(z, r[8], _mm256_fmadd_ps(y, r[7], _mm256_mul_ps(x, r[6])));
+    _mm256_store_ps(dx + i, nx);
+    _mm256_store_ps(dy + i, ny);
+    _mm256_store_ps(dz + i, nz);
+  }
+}
+
+__attribute__((target("avx512f")))
+void rotate_avx512(const float *sx, const float *sy, const float *sz,
+                   float *dx, float *dy, float *dz,
+                   std::size_t n, const float (&m)[9]) {
+  __m512 r[9];
+  for (int k = 0; k < 9; k++) r[k] = _mm512_set1_ps(m[k]);
+  for (std::size_t i = 0; i < n; i += 16) {
+    __m512 x = _mm512_load_ps(sx + i);
+    __m512 y = _mm512_load_ps(sy + i);
+    __m512 z = _mm512_load_ps(sz + i);
+    __m512 nx = _mm512_fmadd_ps(z, r[2], _mm512_fmadd_ps(y, r[1], _mm512_mul_ps(x, r[0])));
+    __m512 ny = _mm512_fmadd_ps(z, r[5], _mm512_fmadd_ps(y, r[4], _mm512_mul_ps(x, r[3])));
+    __m512 nz = _mm512_fmadd_ps(z, r[8], _mm512_fmadd_ps(y, r[7], _mm512_mul_ps(x, r[6])));
+    _mm512_store_ps(dx + i, nx);
+    _mm512_store_ps(dy + i, ny);
+    _mm512_store_ps(dz + i, nz);
+  }
+}
+#endif
+
+#if defined(TORUS_NEON)
+// neon is always there on aarch64, 4 lanes per register and one register of x, y and z per step
+void rotate_neon(const float *sx, const float *sy, const float *sz,
+                 float *dx, float *dy, float *dz,
+                 std::size_t n, const float (&m)[9]) {
+  float32x4_t r[9];
+  for (int k = 0; k < 9; k++) r[k] = vdupq_n_f32(m[k]);
+  for (std::size_t i = 0; i < n; i += 4) {
+    float32x4_t x = vld1q_f32(sx + i);
+    float32x4_t y = vld1q_f32(sy + i);
+    float32x4_t z = vld1q_f32(sz + i);
+    float32x4_t nx = vfmaq_f32(vfmaq_f32(vmulq_f32(x, r[0]), y, r[1]), z, r[2]);
+    float32x4_t ny = vfmaq_f32(vfmaq_f32(vmulq_f32(x, r[3]), y, r[4]), z, r[5]);
+    float32x4_t nz = vfmaq_f32(vfmaq_f32(vmulq_f32(x, r[6]), y, r[7]), z, r[8]);
+    vst1q_f32(dx + i, nx);
+    vst1q_f32(dy + i, ny);
+    vst1q_f32(dz + i, nz);
+  }
+}
+#endif
+
+// pick the widest kernel the cpu we're running on supports
+RotateKernel select_rotate_kernel() {
+#if defined(TORUS_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return rotate_avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return rotate_avx2;
+#elif defined(TORUS_NEON)
+  return rotate_neon;
+#endif
+  return rotate_scalar;
+}
+
+// only main() replaces it, for --kernel, before anything has rotated
+RotateKernel ROTATE_KERNEL = select_rotate_kernel();
+
+// the kernel --kernel name asks for, nullptr when this build or this cpu can't run it
+RotateKernel rotate_kernel_named(const std::string &name) {
+  if (name == "scalar") return rotate_scalar;
+#if defined(TORUS_X86)
+  __builtin_cpu_init();
+  if (name == "avx512" && __builtin_cpu_supports("avx512f")) return rotate_avx512;
+  if (name == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return rotate_avx2;
+#elif defined(TORUS_NEON)
+  if (name == "neon") return rotate_neon;
+#endif
+  return nullptr;
+}
+
+const char *rotate_kernel_name() {
+#if defined(TORUS_X86)
+  if (ROTATE_KERNEL == rotate_avx512) return "avx512";
+  if (ROTATE_KERNEL == rotate_avx2) return "avx2";
+#elif defined(TORUS_NEON)
+  if (ROTATE_KERNEL == rotate_neon) return "neon";
+#endif
+  return "scalar";
+}
+
+void rotate_mesh(Mesh &mesh, const float (&rot)[9]) {
+  ROTATE_KERNEL(mesh.x.data(), mesh.y.data(), mesh.z.data(),
+                mesh.x.data(), mesh.y.data(), mesh.z.data(),
+                mesh.padded(), rot);
+  ROTATE_KERNEL(mesh.nx.data(), mesh.ny.data(), mesh.nz.data(),
+                mesh.nx.data(), mesh.ny.data(), mesh.nz.data(),
+                mesh.padded(), rot);
+}
+
+// painter's order, back to front
+void sort_mesh(Mesh &mesh, FrameArena &arena) {
+  std::uint32_t *order = arena.alloc<std::uint32_t>(mesh.count);
+  for (std::size_t i = 0; i < mesh.count; i++) {
+    order[i] = static_cast<std::uint32_t>(i);
+  }
+  std::sort(order, order + mesh.count, [&](std::uint32_t a, std::uint32_t b) {
+    return order_points(mesh.at(a), mesh.at(b));
+  });
+  float *tmp = arena.alloc<float>(mesh.count);
+  for (FloatArray *a : {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz}) {
+    for (std::size_t i = 0; i < mesh.count; i++) {
+      tmp[i] = (*a)[order[i]];
+    }
+    std::copy(tmp, tmp + mesh.count, a->begin());
+  }
+}
+
+// outward unit normal of the torus at a point on its surface
+inline Point torus_normal(const Point &p) {
+  float rho = std::sqrt(p.x * p.x + p.y * p.y);
+  float k = rho > 0.0f ? g_params.major_radius / rho : 0.0f;
+  Point n{p.x - p.x * k, p.y - p.y * k, p.z};
+  float len = std::sqrt(n.x * n.x + n.y * n.y + n.z * n.z);
+  if (len > 0.0f) {
+    n.x /= len;
+    n.y /= len;
+    n.z /= len;
   }
+  return n;
 }
 
-std::vector<Point> init_mesh() {
-  std::vector<Point> points;
-  for (int i=0; i<NUM_POINTS; i++) {
-    for (int j=0; j<NUM_POINTS; j++) {
+// grid-sampled mesh: solve for z over a num_points x num_points x/y grid, half keeps only +z
+Mesh init_mesh(bool half = false) {
+  Mesh points;
+  points.mirrored = half;
+  const int num_points = g_params.num_points;
+  for (int i=0; i<num_points; i++) {
+    for (int j=0; j<num_points; j++) {
       float x = mesh_to_value(i);
       float y = mesh_to_value(j);
       std::optional<float> z = calculate_pos_z(x, y);
@@ -96,75 +1115,2748 @@ std::vector<Point> init_mesh() {
         p.x = x;
         p.y = y;
         p.z = z.value();
-        points.push_back(p);
+        points.push_back(p, torus_normal(p));
+        if (half) continue;
         p.z = -1.0 * z.value(); // if we only get half a donut, this is why
-        points.push_back(p);
+        points.push_back(p, torus_normal(p));
       }
     }
   }
+  points.pad();
+  return points;
+}
+
+// Sample spacing that keeps neighbouring points under half a cell apart on a rows x cols
+// terminal, so the projected surface has no holes whatever way it's facing. density scales
+// the number of samples along each direction.
+inline float sample_step(int term_rows, int term_cols, float density) {
+  if (term_rows <= 0 || term_cols <= 0) {
+    term_rows = 24;
+    term_cols = 80;
+  }
+  float cell = 2.0f * g_params.max_x_y / static_cast<float>(std::max(term_rows, term_cols));
+  return 0.5f * cell / density;
+}
+
+// Parametric mesh: walk the tube angle phi and the ring angle theta directly, so every
+// sample lands on the surface. Each phi ring gets as many theta steps as its circumference
+// needs, which keeps the density uniform over the whole surface. half only walks phi over
+// [0, pi], the z >= 0 side, since phi and -phi are mirror images in z.
+Mesh init_mesh_parametric(int term_rows, int term_cols, float density = 1.0f, bool half = false) {
+  const float step = sample_step(term_rows, term_cols, density);
+  const float major = g_params.major_radius;
+  const float minor = g_params.minor_radius;
+  const float two_pi = 2.0f * static_cast<float>(M_PI);
+  // even, so phi = pi is a sample and the half walk ends exactly on it
+  const int n_phi = std::max(8, static_cast<int>(std::ceil(two_pi * minor / step / 2.0f)) * 2);
+  const int last_phi = half ? n_phi / 2 : n_phi - 1;
+
+  std::size_t total = 0;
+  for (int i = 0; i <= last_phi; i++) {
+    float rho = major + minor * std::cos(two_pi * i / n_phi);
+    total += static_cast<std::size_t>(std::ceil(two_pi * rho / step));
+  }
+
+  Mesh points;
+  points.mirrored = half;
+  points.reserve(total);
+  for (int i = 0; i <= last_phi; i++) {
+    float phi = two_pi * i / n_phi;
+    float cp = std::cos(phi);
+    float sp = std::sin(phi);
+    float rho = major + minor * cp;
+    int n_theta = std::max(8, static_cast<int>(std::ceil(two_pi * rho / step)));
+    for (int j = 0; j < n_theta; j++) {
+      float theta = two_pi * j / n_theta;
+      float ct = std::cos(theta);
+      float st = std::sin(theta);
+      points.push_back(Point{rho * ct, rho * st, minor * sp},
+                       Point{cp * ct, cp * st, sp});
+    }
+  }
+  points.pad();
   return points;
 }
 
+// write the whole buffer, retrying on partial writes and signals
+bool write_all(int fd, const char *data, std::size_t len) {
+  while (len > 0) {
+    ssize_t n = ::write(fd, data, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    len -= static_cast<std::size_t>(n);
+  }
+  return true;
+}
+
+// Binary mesh cache. Each generated mesh is stored in its own file under --mesh-cache, named
+// after a hash of everything that went into it and headed by those same fields, then mapped
+// on the next start instead of being generated again.
+//
+// bump when a generator changes what it puts out, older files then stop matching
+constexpr std::uint32_t MESH_VERSION = 1;
+
+const char MESH_MAGIC[8] = {'T', 'O', 'R', 'U', 'S', 'M', 'S', 'H'};
+
+struct MeshKey {
+  std::uint32_t version = MESH_VERSION;
+  std::uint8_t kind = 0; // MeshKind
+  std::uint8_t half = 0;
+  std::uint8_t pad[2] = {};
+  float major_radius = 0.0f;
+  float minor_radius = 0.0f;
+  std::int32_t num_points = 0; // grid only
+  std::int32_t rows = 0; // parametric only, what the walk was sized for
+  std::int32_t cols = 0;
+  float density = 0.0f;
+};
+
+// what a mesh file holds after the magic and key
+struct MeshHeader {
+  std::uint64_t count;
+  std::uint64_t padded;
+};
+
+std::string mesh_cache_file(const std::string &dir, const MeshKey &key) {
+  std::uint32_t h = 2166136261u; // fnv-1a over the key bytes
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&key);
+  for (std::size_t i = 0; i < sizeof(key); i++) h = (h ^ bytes[i]) * 16777619u;
+  char name[32];
+  std::snprintf(name, sizeof(name), "/mesh-%08x.bin", h);
+  return dir + name;
+}
+
+// map a mesh written by save_mesh(), false if it's missing or was made from another key
+bool load_mesh(const std::string &path, const MeshKey &key, Mesh &mesh) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st{};
+  const std::size_t header = sizeof(MESH_MAGIC) + sizeof(MeshKey) + sizeof(MeshHeader);
+  if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < header) {
+    ::close(fd);
+    return false;
+  }
+  const std::size_t size = static_cast<std::size_t>(st.st_size);
+  void *map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const char *base = static_cast<const char *>(map);
+  MeshHeader h;
+  std::memcpy(&h, base + sizeof(MESH_MAGIC) + sizeof(MeshKey), sizeof(h));
+  bool ok = std::memcmp(base, MESH_MAGIC, sizeof(MESH_MAGIC)) == 0 &&
+            std::memcmp(base + sizeof(MESH_MAGIC), &key, sizeof(key)) == 0 &&
+            h.count <= h.padded && h.padded % MESH_LANES == 0 &&
+            size == header + 6 * sizeof(float) * h.padded;
+  if (ok) {
+    // straight into the aligned arrays, one copy per array out of the page cache
+    const float *src = reinterpret_cast<const float *>(base + header);
+    mesh.count = h.count;
+    mesh.mirrored = key.half != 0;
+    for (FloatArray *a : {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz}) {
+      a->assign(src, src + h.padded);
+      src += h.padded;
+    }
+  }
+  ::munmap(map, size);
+  return ok;
+}
+
+bool save_mesh(const std::string &path, const MeshKey &key, const Mesh &mesh) {
+  std::string tmp = path + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  const MeshHeader h{mesh.count, mesh.padded()};
+  bool ok = write_all(fd, MESH_MAGIC, sizeof(MESH_MAGIC)) &&
+            write_all(fd, reinterpret_cast<const char *>(&key), sizeof(key)) &&
+            write_all(fd, reinterpret_cast<const char *>(&h), sizeof(h));
+  for (const FloatArray *a : {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz}) {
+    ok = ok && write_all(fd, reinterpret_cast<const char *>(a->data()), sizeof(float) * a->size());
+  }
+  ok = ::close(fd) == 0 && ok;
+  if (ok) ok = ::rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) ::unlink(tmp.c_str());
+  return ok;
+}
+
+// The mesh for key, from the cache in dir when it's there. Otherwise it's generated and
+// written back; an empty dir turns the cache off.
+Mesh cached_mesh(const std::string &dir, const MeshKey &key) {
+  Mesh mesh;
+  const std::string path = dir.empty() ? std::string() : mesh_cache_file(dir, key);
+  if (!dir.empty() && load_mesh(path, key, mesh)) return mesh;
+  if (key.kind == static_cast<std::uint8_t>(MeshKind::Grid)) {
+    mesh = init_mesh(key.half);
+  } else {
+    mesh = init_mesh_parametric(key.rows, key.cols, key.density, key.half);
+  }
+  if (!dir.empty() && !save_mesh(path, key, mesh)) {
+    std::cerr << "torus: can't write mesh cache " << path << ": " << std::strerror(errno) << "\n";
+  }
+  return mesh;
+}
+
+MeshKey mesh_key(MeshKind kind, int rows, int cols, float density, bool half) {
+  MeshKey key;
+  key.kind = static_cast<std::uint8_t>(kind);
+  key.half = half;
+  key.major_radius = g_params.major_radius;
+  key.minor_radius = g_params.minor_radius;
+  if (kind == MeshKind::Grid) {
+    key.num_points = g_params.num_points;
+  } else {
+    key.rows = rows;
+    key.cols = cols;
+    key.density = density;
+  }
+  return key;
+}
+
 void render_point(const Point &p, int term_rows, int term_cols){
-  float x = convert_range(p.x, -MAX_X_Y, MAX_X_Y, 0, static_cast<int>(term_cols));
-  float y = convert_range(p.y, -MAX_X_Y, MAX_X_Y, 0, static_cast<int>(term_rows));
+  const float max_x_y = g_params.max_x_y;
+  float x = convert_range(p.x, -max_x_y, max_x_y, 0, static_cast<int>(term_cols));
+  float y = convert_range(p.y, -max_x_y, max_x_y, 0, static_cast<int>(term_rows));
   int term_x = std::floor(x);
   int term_y = std::floor(y);
   print_at_pos(term_y, term_x, '%');
 }
 
-void render_mesh(const std::vector<Point> &points, int term_rows, int term_cols) {
-  // Back buffer: one string per cell (because SYMBOLS are UTF-8, not single bytes)
-  std::vector<std::string> screen(term_rows * term_cols, " ");
-  std::vector<float> depth(term_rows * term_cols, -1e9f); // very far back
+const float FAR_DEPTH = -1e9f; // very far back
+const std::int32_t FIXED_FAR_DEPTH = INT32_MIN;
 
-  for (const Point &p : points) {
-    // Project 3D point -> 2D terminal coordinates
-    float sx = convert_range(p.x, -MAX_X_Y, MAX_X_Y, 0.0f, term_cols - 1.0f);
-    float sy = convert_range(p.y, -MAX_X_Y, MAX_X_Y, 0.0f, term_rows - 1.0f);
+// cells per side of the coarse occlusion tiles
+constexpr int TILE = 8;
 
-    int col = static_cast<int>(std::floor(sx));
-    int row = static_cast<int>(std::floor(sy));
+// what the rasterizer did to one frame buffer, each worker counts into its own
+struct RasterCounts {
+  std::uint64_t points = 0; // surface points considered, mirrors included
+  std::uint64_t culled = 0; // of those, dropped before projection
+  std::uint64_t cells = 0; // depth tests won
 
-    if (col < 0 || col >= term_cols || row < 0 || row >= term_rows) {
-      continue;
-    }
+  void add(const RasterCounts &o) {
+    points += o.points;
+    culled += o.culled;
+    cells += o.cells;
+  }
+};
 
-    int idx = row * term_cols + col;
+// Persistent back buffer that lives across frames. Each cell is one shade byte, 0 for empty
+// and n for glyph_table[n - 1], so the UTF-8 glyphs are only expanded when a line gets encoded.
+struct FrameBuffer {
+  int rows = 0;
+  int cols = 0;
+  RasterCounts counts; // since the last clear
+  std::vector<std::uint8_t> shade;
+  std::vector<float> depth;
+  std::vector<std::int32_t> fixed_depth; // Q16.16 depth, used instead by the fixed-point path
+
+  // Coarse occlusion tiles for tile culling. A tile's min is FAR_DEPTH until every one of its
+  // cells is covered, then the nearest-to-far depth among them. Depths only ever grow, so a
+  // stale min stays a safe lower bound for the rest of the frame.
+  int tile_rows = 0;
+  int tile_cols = 0;
+  std::vector<float> tile_min;
+  std::vector<std::uint16_t> tile_open; // cells of the tile nothing has landed on yet
+  std::vector<std::uint16_t> tile_cells;
+
+  // only touches the heap when the frame grows past anything seen before
+  void resize(int new_rows, int new_cols) {
+    rows = new_rows;
+    cols = new_cols;
+    shade.resize(static_cast<std::size_t>(rows) * cols);
+    depth.resize(static_cast<std::size_t>(rows) * cols);
+    tile_rows = (rows + TILE - 1) / TILE;
+    tile_cols = (cols + TILE - 1) / TILE;
+    tile_min.resize(static_cast<std::size_t>(tile_rows) * tile_cols);
+    tile_open.resize(tile_min.size());
+    tile_cells.resize(tile_min.size());
+    for (int tr = 0; tr < tile_rows; tr++) {
+      for (int tc = 0; tc < tile_cols; tc++) {
+        int h = std::min(TILE, rows - tr * TILE);
+        int w = std::min(TILE, cols - tc * TILE);
+        tile_cells[tr * tile_cols + tc] = static_cast<std::uint16_t>(h * w);
+      }
+    }
+  }
 
-    // Simple depth test: larger z = closer to camera
-    if (p.z > depth[idx]) {
-      depth[idx] = p.z;
+  void clear() {
+    counts = RasterCounts{};
+    std::fill(shade.begin(), shade.end(), 0);
+    std::fill(depth.begin(), depth.end(), FAR_DEPTH);
+    std::fill(tile_min.begin(), tile_min.end(), FAR_DEPTH);
+    std::copy(tile_cells.begin(), tile_cells.end(), tile_open.begin());
+  }
 
-      // Map z in [-MAX_X_Y, MAX_X_Y] -> {0,1,2,3}
-      float norm = (p.z + MAX_X_Y) / (2.0f * MAX_X_Y); // 0..1
-      int shade = static_cast<int>(norm * 4.0f);
-      if (shade < 0) shade = 0;
-      if (shade > 3) shade = 3;
+  // clear() for the fixed-point path, sized on first use so float-only runs never carry it
+  void clear_fixed() {
+    counts = RasterCounts{};
+    std::fill(shade.begin(), shade.end(), 0);
+    fixed_depth.assign(shade.size(), FIXED_FAR_DEPTH);
+  }
 
-      screen[idx] = SYMBOLS[shade];
+  // a cell of tile t got its first point, once the whole tile is covered it can occlude
+  void cover(int t, int tr, int tc) {
+    if (--tile_open[t] != 0) return;
+    float m = -FAR_DEPTH;
+    int r_end = std::min(rows, (tr + 1) * TILE);
+    int c_end = std::min(cols, (tc + 1) * TILE);
+    for (int r = tr * TILE; r < r_end; r++) {
+      for (int c = tc * TILE; c < c_end; c++) {
+        m = std::min(m, depth[r * cols + c]);
+      }
     }
+    tile_min[t] = m;
   }
 
-  // Draw frame in one go
-  std::cout << "\033[H";  // cursor home (no need to full clear every frame)
-  for (int r = 0; r < term_rows; ++r) {
-    for (int c = 0; c < term_cols; ++c) {
-      std::cout << screen[r * term_cols + c];
+  // true when every tile under the screen box [c0, c1] x [r0, r1] is already covered by
+  // something nearer than z, so no point in there with depth <= z can win a cell
+  bool occluded(int r0, int r1, int c0, int c1, float z) const {
+    r0 = std::max(r0, 0) / TILE;
+    c0 = std::max(c0, 0) / TILE;
+    r1 = std::min(r1, rows - 1) / TILE;
+    c1 = std::min(c1, cols - 1) / TILE;
+    for (int tr = r0; tr <= r1; tr++) {
+      for (int tc = c0; tc <= c1; tc++) {
+        if (tile_min[tr * tile_cols + tc] < z) return false;
+      }
     }
-    std::cout << '\n';
+    return true;
+  }
+};
+
+inline void append_cell(std::string &out, std::uint8_t shade) {
+  if (shade == 0) {
+    out += ' ';
+  } else {
+    out += g_params.glyph_table[shade - 1];
   }
-  std::cout.flush();
 }
 
-int main() {
-  struct winsize w{};
-  ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-  std::vector<Point> points = init_mesh();
-  while (true) {
-    rotate_mesh(points);
-    std::sort(points.begin(), points.end(), order_points);
-    render_mesh(points, w.ws_row, w.ws_col);
+inline std::size_t cell_bytes(std::uint8_t shade) {
+  return shade == 0 ? 1 : g_params.glyph_table[shade - 1].size();
+}
+
+// append the UTF-8 for one row of the frame
+inline void encode_line(const FrameBuffer &fb, int row, std::string &out) {
+  const std::uint8_t *cells = fb.shade.data() + static_cast<std::size_t>(row) * fb.cols;
+  for (int c = 0; c < fb.cols; ++c) {
+    append_cell(out, cells[c]);
+  }
+}
+
+inline void append_int(std::string &out, int v) {
+  char digits[12];
+  int n = 0;
+  do {
+    digits[n++] = static_cast<char>('0' + v % 10);
+    v /= 10;
+  } while (v > 0);
+  while (n > 0) out += digits[--n];
+}
+
+// same escape print_at_pos() writes, 1-based row and column
+inline void append_at_pos(std::string &out, int row, int col) {
+  out += "\033[";
+  append_int(out, row);
+  out += ';';
+  append_int(out, col);
+  out += 'H';
+}
+
+// typical terminal cell, width over height, for when the terminal doesn't report pixel sizes
+const float CELL_ASPECT = 0.5f;
+
+// Screen mapping for one frame, built once per frame and shared by every point and worker.
+// By default it's orthographic and stretched so the torus fills the frame on both axes. With
+// --perspective both axes get one scale, corrected for the cell aspect so the torus keeps its
+// shape, and points are divided by their distance from a camera on the +z axis.
+struct Projection {
+  float col_scale = 1.0f; // col = x * w * col_scale + col_offset, same for rows with y
+  float col_offset = 0.0f;
+  float row_scale = 1.0f;
+  float row_offset = 0.0f;
+  bool perspective = false;
+  float distance = 0.0f; // camera z
+  float focal = 1.0f; // w = focal / (distance - z)
+
+  // aspect is the width over height of one cell of the frame, only the camera looks at it
+  static Projection make(int rows, int cols, float aspect) {
+    const float max_x_y = g_params.max_x_y;
+    Projection p;
+    p.col_scale = (cols - 1.0f) / (2.0f * max_x_y);
+    p.row_scale = (rows - 1.0f) / (2.0f * max_x_y);
+    p.col_offset = (cols - 1.0f) * 0.5f;
+    p.row_offset = (rows - 1.0f) * 0.5f;
+    if (g_params.perspective) {
+      // the tighter axis decides, in row heights per unit, a column is aspect heights wide
+      float s = std::min(p.row_scale, p.col_scale * aspect);
+      p.row_scale = s;
+      p.col_scale = s / aspect;
+      // Rotation keeps every point inside the sphere of radius max_x_y, so distance - z is
+      // never below focal: w stays in (0, 1] and the torus never leaves the frame. A drifted
+      // --in-place mesh can get closer than that, so w() clamps to 1 instead of blowing up.
+      p.perspective = true;
+      p.distance = g_params.camera_distance * max_x_y;
+      p.focal = p.distance - max_x_y;
+    }
+    return p;
+  }
+
+  float w(float z) const { return perspective ? focal / std::max(distance - z, focal) : 1.0f; }
+};
+
+// The number types the rasterizer is written against, so one kernel serves both. FloatMath
+// is the float pipeline as is. FixedMath does the same steps in Q16.16: integer rotation
+// (64-bit products shifted back down), projection by shifts, an integer depth buffer and
+// clamped table indices in place of float-to-int conversions. Perspective and tile culling
+// stay float only; Pipeline falls back to FloatMath for them.
+//
+// unit() is the world length of 1 in the mesh coordinates a policy reads. FixedMath stores
+// positions over max_x_y, so they stay within [-1, 1] and use all 16 fraction bits whatever
+// the radii, and the kernel folds unit() into its projection and depth scales instead.
+struct FloatMath {
+  using Real = float;
+  static constexpr bool fixed = false;
+  static float unit() { return 1.0f; }
+  static Real from_float(float v) { return v; }
+  static Real mul(Real a, Real b) { return a * b; }
+  static int floor(Real v) { return static_cast<int>(std::floor(v)); }
+  // an in-place mesh can drift out of the sphere, so clamp, truncation keeps -0.0001 at 0
+  static int index(Real v) { return std::clamp(static_cast<int>(v), 0, SHADE_LEVELS); }
+
+  static const Real *x(const Mesh &m) { return m.x.data(); }
+  static const Real *y(const Mesh &m) { return m.y.data(); }
+  static const Real *z(const Mesh &m) { return m.z.data(); }
+  static const Real *nx(const Mesh &m) { return m.nx.data(); }
+  static const Real *ny(const Mesh &m) { return m.ny.data(); }
+  static const Real *nz(const Mesh &m) { return m.nz.data(); }
+  static Real *depth(FrameBuffer &fb) { return fb.depth.data(); }
+  static void clear(FrameBuffer &fb) { fb.clear(); }
+
+  static void rotate(const Real *sx, const Real *sy, const Real *sz, Real *dx, Real *dy, Real *dz,
+                     std::size_t n, const float (&rot)[9], const Real (&)[9]) {
+    ROTATE_KERNEL(sx, sy, sz, dx, dy, dz, n, rot);
+  }
+};
+
+struct FixedMath {
+  using Real = std::int32_t;
+  static constexpr bool fixed = true;
+  static float unit() { return g_params.max_x_y; }
+  static Real from_float(float v) { return to_fixed(v); }
+  static Real mul(Real a, Real b) {
+    return static_cast<Real>((static_cast<std::int64_t>(a) * b) >> FIXED_FRAC);
+  }
+  static int floor(Real v) { return v >> FIXED_FRAC; }
+  // rounding can put a point a hair outside the sphere, so clamp instead of trusting it
+  static int index(Real v) { return std::clamp(v >> FIXED_FRAC, 0, SHADE_LEVELS); }
+
+  static const Real *x(const Mesh &m) { return m.qx.data(); }
+  static const Real *y(const Mesh &m) { return m.qy.data(); }
+  static const Real *z(const Mesh &m) { return m.qz.data(); }
+  static const Real *nx(const Mesh &m) { return m.qnx.data(); }
+  static const Real *ny(const Mesh &m) { return m.qny.data(); }
+  static const Real *nz(const Mesh &m) { return m.qnz.data(); }
+  static Real *depth(FrameBuffer &fb) { return fb.fixed_depth.data(); }
+  static void clear(FrameBuffer &fb) { fb.clear_fixed(); }
+
+  static void rotate(const Real *sx, const Real *sy, const Real *sz, Real *dx, Real *dy, Real *dz,
+                     std::size_t n, const float (&)[9], const Real (&m)[9]) {
+    for (std::size_t i = 0; i < n; i++) {
+      const Real x = sx[i], y = sy[i], z = sz[i];
+      dx[i] = mul(m[0], x) + mul(m[1], y) + mul(m[2], z);
+      dy[i] = mul(m[3], x) + mul(m[4], y) + mul(m[5], z);
+      dz[i] = mul(m[6], x) + mul(m[7], y) + mul(m[8], z);
+    }
+  }
+};
+
+// Row of a matrix the compiler knows applied to (x, y, z). Zero weights drop out and unit
+// weights skip their multiply, which float math can't do on its own: x * 0 isn't 0 for NaN.
+// The sum starts at -0, the one float that adding leaves every value as it was.
+template <const float *M, int Row, typename Math, typename Real = typename Math::Real>
+inline Real baked_row(Real x, Real y, Real z) {
+  Real sum = Math::from_float(-0.0f);
+  auto term = [&](auto k, Real v) {
+    constexpr float w = M[3 * Row + decltype(k)::value];
+    if constexpr (w == 1.0f) {
+      sum += v;
+    } else if constexpr (w == -1.0f) {
+      sum -= v;
+    } else if constexpr (w != 0.0f) {
+      sum += Math::mul(v, Math::from_float(w));
+    }
+  };
+  term(std::integral_constant<int, 0>{}, x);
+  term(std::integral_constant<int, 1>{}, y);
+  term(std::integral_constant<int, 2>{}, z);
+  return sum;
+}
+
+// points per block of the fused pass, small enough that a rotated block never leaves L1
+constexpr std::size_t RASTER_BLOCK = 256;
+static_assert(RASTER_BLOCK % MESH_LANES == 0, "blocks must stay vector aligned");
+
+// points bounded together for tile culling
+constexpr std::size_t CULL_GROUP = 16;
+
+// Fused transform-project-rasterize over mesh points [begin, end), begin a multiple of
+// RASTER_BLOCK. Each block is rotated by the SIMD kernel into stack scratch and then projected,
+// depth tested and shaded straight from there, so the mesh is read once and never written.
+// The kernel is specialized on the shading mode, Lambert also rotates the block's normals.
+// For a mirrored mesh, the mirror of p = R(x, y, z) is R(x, y, -z) = p - 2z * R[:, 2], so each
+// stored point is plotted twice from one rotation.
+//
+// Culling happens before a point is projected. Cull drops points whose rotated normal faces
+// away from the viewer: on a closed surface those are always behind a front face.
+// With tile culling on, each group of CULL_GROUP points is first bounded on screen and skipped
+// whole when every tile under it is already covered by something nearer than its nearest point.
+//
+// Baked, when set, is a matrix known at compile time that stands in for rot, see baked_row().
+template <typename Math, ShadeMode Mode, bool Mirror, bool Cull, const float *Baked = nullptr>
+void raster_range_shaded(const Mesh &mesh, const float (&rot)[9], const Projection &proj,
+                         FrameBuffer &fb, RenderPath path, std::size_t begin, std::size_t end) {
+  using Real = typename Math::Real;
+  const int term_rows = fb.rows;
+  const int term_cols = fb.cols;
+  Real r[9];
+  for (int k = 0; k < 9; k++) r[k] = Math::from_float(rot[k]);
+  const Real col_scale = Math::from_float(proj.col_scale * Math::unit());
+  const Real col_offset = Math::from_float(proj.col_offset);
+  const Real row_scale = Math::from_float(proj.row_scale * Math::unit());
+  const Real row_offset = Math::from_float(proj.row_offset);
+  const bool perspective = !Math::fixed && proj.perspective;
+  const float camera = proj.distance;
+  const float focal = proj.focal;
+  const std::uint8_t *lut = g_params.shade_lut;
+  const Real depth_scale = Math::from_float(g_params.depth_scale * Math::unit());
+  const Real depth_bias = Math::from_float(g_params.depth_bias);
+  const Real lx = Math::from_float(g_params.light[0] * (SHADE_LEVELS / 2.0f));
+  const Real ly = Math::from_float(g_params.light[1] * (SHADE_LEVELS / 2.0f));
+  const Real lz = Math::from_float(g_params.light[2] * (SHADE_LEVELS / 2.0f));
+  // twice the rotated z basis vector, what a mirrored point is offset by per unit of z
+  const float *m = rot;
+  if constexpr (Baked != nullptr) m = Baked;
+  const Real mx = Math::from_float(2.0f * m[2]);
+  const Real my = Math::from_float(2.0f * m[5]);
+  const Real mz = Math::from_float(2.0f * m[8]);
+  const bool tile_cull = !Math::fixed && g_params.tile_cull && path == RenderPath::ZBuffer;
+  Real *depth = Math::depth(fb);
+  alignas(MESH_ALIGN) Real bx[RASTER_BLOCK];
+  alignas(MESH_ALIGN) Real by[RASTER_BLOCK];
+  alignas(MESH_ALIGN) Real bz[RASTER_BLOCK];
+  alignas(MESH_ALIGN) Real bnx[Mode == ShadeMode::Lambert ? RASTER_BLOCK : 1];
+  alignas(MESH_ALIGN) Real bny[Mode == ShadeMode::Lambert ? RASTER_BLOCK : 1];
+  alignas(MESH_ALIGN) Real bnz[Mode == ShadeMode::Lambert ? RASTER_BLOCK : 1];
+  // kept in registers and added to fb.counts once at the end
+  std::uint64_t culled = 0;
+  std::uint64_t cells = 0;
+
+  auto plot = [&](Real x, Real y, Real z, Real nx, Real ny, Real nz) {
+    // Project 3D point -> 2D terminal coordinates, one divide and then multiplies
+    if constexpr (!Math::fixed) {
+      if (perspective) {
+        float w = focal / std::max(camera - z, focal); // see Projection::make
+        x *= w;
+        y *= w;
+      }
+    }
+    int col = Math::floor(Math::mul(x, col_scale) + col_offset);
+    int row = Math::floor(Math::mul(y, row_scale) + row_offset);
+
+    if (col < 0 || col >= term_cols || row < 0 || row >= term_rows) {
+      return;
+    }
+
+    int idx = row * term_cols + col;
+
+    // Simple depth test: larger z = closer to camera. The painter's path is already
+    // sorted back to front, so every point just overwrites what's under it.
+    if (path == RenderPath::Painter || z > depth[idx]) {
+      if constexpr (!Math::fixed) {
+        if (tile_cull && depth[idx] == FAR_DEPTH) {
+          depth[idx] = z; // cover() reads it back
+          fb.cover((row / TILE) * fb.tile_cols + col / TILE, row / TILE, col / TILE);
+        }
+      }
+      depth[idx] = z;
+      cells++;
+      int q;
+      if constexpr (Mode == ShadeMode::Lambert) {
+        q = Math::index(Math::mul(nx, lx) + Math::mul(ny, ly) + Math::mul(nz, lz) + depth_bias);
+      } else {
+        q = Math::index(Math::mul(z, depth_scale) + depth_bias);
+      }
+      fb.shade[idx] = lut[q];
+    }
+  };
+
+  // seen from +z, or from the camera at (0, 0, camera) for the perspective view vector
+  auto facing = [&](Real x, Real y, Real z, Real nx, Real ny, Real nz) {
+    if constexpr (!Math::fixed) {
+      if (perspective) return nz * (camera - z) - nx * x - ny * y >= 0.0f;
+    }
+    return nz >= 0;
+  };
+
+  const Real *mesh_x = Math::x(mesh);
+  const Real *mesh_y = Math::y(mesh);
+  const Real *mesh_z = Math::z(mesh);
+  const Real *mesh_nx = Math::nx(mesh);
+  const Real *mesh_ny = Math::ny(mesh);
+  const Real *mesh_nz = Math::nz(mesh);
+  for (std::size_t base = begin; base < end; base += RASTER_BLOCK) {
+    // the arrays are padded to MESH_LANES, so whole vectors past count are safe to read
+    std::size_t n = std::min(RASTER_BLOCK, mesh.padded() - base);
+    if constexpr (Baked != nullptr) {
+      for (std::size_t i = 0; i < n; i++) {
+        const Real x = mesh_x[base + i], y = mesh_y[base + i], z = mesh_z[base + i];
+        bx[i] = baked_row<Baked, 0, Math>(x, y, z);
+        by[i] = baked_row<Baked, 1, Math>(x, y, z);
+        bz[i] = baked_row<Baked, 2, Math>(x, y, z);
+        if constexpr (Mode == ShadeMode::Lambert) {
+          const Real nx = mesh_nx[base + i], ny = mesh_ny[base + i], nz = mesh_nz[base + i];
+          bnx[i] = baked_row<Baked, 0, Math>(nx, ny, nz);
+          bny[i] = baked_row<Baked, 1, Math>(nx, ny, nz);
+          bnz[i] = baked_row<Baked, 2, Math>(nx, ny, nz);
+        }
+      }
+    } else {
+      Math::rotate(mesh_x + base, mesh_y + base, mesh_z + base, bx, by, bz, n, rot, r);
+      if constexpr (Mode == ShadeMode::Lambert) {
+        Math::rotate(mesh_nx + base, mesh_ny + base, mesh_nz + base, bnx, bny, bnz, n, rot, r);
+      }
+    }
+    std::size_t live = std::min(n, end - base);
+    const Real *z0 = mesh_z + base;
+    const Real *nx0 = mesh_nx + base;
+    const Real *ny0 = mesh_ny + base;
+    const Real *nz0 = mesh_nz + base;
+
+    for (std::size_t g = 0; g < live; g += CULL_GROUP) {
+      const std::size_t g_end = std::min(live, g + CULL_GROUP);
+      if constexpr (!Math::fixed) {
+        if (tile_cull) {
+          float x_lo = bx[g], x_hi = bx[g], y_lo = by[g], y_hi = by[g], z_lo = bz[g], z_hi = bz[g];
+          for (std::size_t i = g; i < g_end; i++) {
+            x_lo = std::min(x_lo, bx[i]);
+            x_hi = std::max(x_hi, bx[i]);
+            y_lo = std::min(y_lo, by[i]);
+            y_hi = std::max(y_hi, by[i]);
+            z_lo = std::min(z_lo, bz[i]);
+            z_hi = std::max(z_hi, bz[i]);
+            if constexpr (Mirror) {
+              float k = z0[i];
+              x_lo = std::min(x_lo, bx[i] - k * mx);
+              x_hi = std::max(x_hi, bx[i] - k * mx);
+              y_lo = std::min(y_lo, by[i] - k * my);
+              y_hi = std::max(y_hi, by[i] - k * my);
+              z_lo = std::min(z_lo, bz[i] - k * mz);
+              z_hi = std::max(z_hi, bz[i] - k * mz);
+            }
+          }
+          if (perspective) {
+            // x * w over the box is extreme at its corners, w runs from w(z_lo) to w(z_hi)
+            float w_lo = proj.w(z_lo), w_hi = proj.w(z_hi);
+            x_lo = std::min(x_lo * w_lo, x_lo * w_hi);
+            x_hi = std::max(x_hi * w_lo, x_hi * w_hi);
+            y_lo = std::min(y_lo * w_lo, y_lo * w_hi);
+            y_hi = std::max(y_hi * w_lo, y_hi * w_hi);
+          }
+          int c0 = static_cast<int>(std::floor(x_lo * col_scale + col_offset));
+          int c1 = static_cast<int>(std::floor(x_hi * col_scale + col_offset));
+          int r0 = static_cast<int>(std::floor(y_lo * row_scale + row_offset));
+          int r1 = static_cast<int>(std::floor(y_hi * row_scale + row_offset));
+          if (fb.occluded(r0, r1, c0, c1, z_hi)) {
+            culled += (g_end - g) * (Mirror ? 2 : 1);
+            continue;
+          }
+        }
+      }
+
+      for (std::size_t i = g; i < g_end; i++) {
+        Real nx = 0, ny = 0, nz = 0;
+        if constexpr (Mode == ShadeMode::Lambert) {
+          nx = bnx[i];
+          ny = bny[i];
+          nz = bnz[i];
+        } else if constexpr (Cull && Baked != nullptr) {
+          nz = baked_row<Baked, 2, Math>(nx0[i], ny0[i], nz0[i]);
+          if (perspective) {
+            nx = baked_row<Baked, 0, Math>(nx0[i], ny0[i], nz0[i]);
+            ny = baked_row<Baked, 1, Math>(nx0[i], ny0[i], nz0[i]);
+          }
+        } else if constexpr (Cull) {
+          // orthographic culling only needs the view-facing component of the rotated normal
+          nz = Math::mul(nx0[i], r[6]) + Math::mul(ny0[i], r[7]) + Math::mul(nz0[i], r[8]);
+          if (perspective) {
+            nx = Math::mul(nx0[i], r[0]) + Math::mul(ny0[i], r[1]) + Math::mul(nz0[i], r[2]);
+            ny = Math::mul(nx0[i], r[3]) + Math::mul(ny0[i], r[4]) + Math::mul(nz0[i], r[5]);
+          }
+        }
+        if (!Cull || facing(bx[i], by[i], bz[i], nx, ny, nz)) {
+          plot(bx[i], by[i], bz[i], nx, ny, nz);
+        } else {
+          culled++;
+        }
+        if constexpr (Mirror) {
+          Real k = z0[i];
+          Real kn = nz0[i];
+          if constexpr (Mode == ShadeMode::Lambert || Cull) {
+            nx -= Math::mul(kn, mx);
+            ny -= Math::mul(kn, my);
+          }
+          nz -= Math::mul(kn, mz);
+          Real x = bx[i] - Math::mul(k, mx), y = by[i] - Math::mul(k, my), z = bz[i] - Math::mul(k, mz);
+          if (!Cull || facing(x, y, z, nx, ny, nz)) {
+            plot(x, y, z, nx, ny, nz);
+          } else {
+            culled++;
+          }
+        }
+      }
+    }
+  }
+  fb.counts.points += (end - begin) * (Mirror ? 2 : 1);
+  fb.counts.culled += culled;
+  fb.counts.cells += cells;
+}
+
+template <typename Math, ShadeMode Mode, bool Mirror, const float *Baked>
+void raster_range_culled(const Mesh &mesh, const float (&rot)[9], const Projection &proj,
+                         FrameBuffer &fb, RenderPath path, std::size_t begin, std::size_t end) {
+  if (g_params.backface_cull) {
+    raster_range_shaded<Math, Mode, Mirror, true, Baked>(mesh, rot, proj, fb, path, begin, end);
+  } else {
+    raster_range_shaded<Math, Mode, Mirror, false, Baked>(mesh, rot, proj, fb, path, begin, end);
+  }
+}
+
+template <typename Math, ShadeMode Mode, const float *Baked>
+void raster_range_mode(const Mesh &mesh, const float (&rot)[9], const Projection &proj,
+                       FrameBuffer &fb, RenderPath path, std::size_t begin, std::size_t end) {
+  if (mesh.mirrored) {
+    raster_range_culled<Math, Mode, true, Baked>(mesh, rot, proj, fb, path, begin, end);
+  } else {
+    raster_range_culled<Math, Mode, false, Baked>(mesh, rot, proj, fb, path, begin, end);
+  }
+}
+
+template <typename Math, const float *Baked = nullptr>
+void raster_range(const Mesh &mesh, const float (&rot)[9], const Projection &proj,
+                  FrameBuffer &fb, RenderPath path, std::size_t begin, std::size_t end) {
+  if (g_params.shading == ShadeMode::Lambert) {
+    raster_range_mode<Math, ShadeMode::Lambert, Baked>(mesh, rot, proj, fb, path, begin, end);
+  } else {
+    raster_range_mode<Math, ShadeMode::Depth, Baked>(mesh, rot, proj, fb, path, begin, end);
+  }
+}
+
+// rot is applied to each point on the fly, so the mesh is only read, never written back
+template <typename Math = FloatMath, const float *Baked = nullptr>
+void render_mesh(const Mesh &mesh, const float (&rot)[9], const Projection &proj, FrameBuffer &fb,
+                 RenderPath path) {
+  Math::clear(fb);
+  raster_range<Math, Baked>(mesh, rot, proj, fb, path, 0, mesh.count);
+}
+
+// Persistent pool of worker threads. The calling thread joins in as worker 0, so a pool of
+// one is just a plain function call with no threads behind it.
+class WorkerPool {
+ public:
+  explicit WorkerPool(int threads) {
+    for (int w = 1; w < threads; w++) {
+      workers_.emplace_back([this, w] { worker_loop(w); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : workers_) t.join();
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int size() const { return static_cast<int>(workers_.size()) + 1; }
+
+  // call fn(task, worker) for every task in [0, tasks) and return once they're all done,
+  // tasks are handed out one at a time from a shared counter so fast workers take more.
+  // fn is only borrowed for the call, so unlike a std::function nothing gets allocated.
+  template <typename Fn>
+  void run(int tasks, Fn &&fn) {
+    if (workers_.empty()) {
+      for (int t = 0; t < tasks; t++) fn(t, 0);
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = [](void *f, int task, int worker) {
+        (*static_cast<std::remove_reference_t<Fn> *>(f))(task, worker);
+      };
+      job_fn_ = const_cast<void *>(static_cast<const void *>(&fn));
+      tasks_ = tasks;
+      next_.store(0);
+      busy_ = static_cast<int>(workers_.size());
+      generation_++;
+    }
+    wake_.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_ == 0; });
+    job_ = nullptr;
+    job_fn_ = nullptr;
+  }
+
+ private:
+  void drain(int worker) {
+    for (int t = next_.fetch_add(1); t < tasks_; t = next_.fetch_add(1)) {
+      job_(job_fn_, t, worker);
+    }
+  }
+
+  void worker_loop(int worker) {
+    std::uint64_t seen = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+        if (stopping_) return;
+        seen = generation_;
+      }
+      drain(worker);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_--;
+      }
+      done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  void (*job_)(void *, int, int) = nullptr;
+  void *job_fn_ = nullptr; // the caller's callable, job_ knows its type
+  int tasks_ = 0;
+  std::atomic<int> next_{0};
+  int busy_ = 0;
+  std::uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
+
+// Level-of-detail set of parametric meshes. Level k is hole-free on terminals up to
+// lod_cells(k) cells along their longest side. Levels go up by sqrt(2) in resolution, so
+// each one has about twice the points of the one below it and a terminal never pays more
+// than 2x over the exact fit. level_for() rounds up, because the level below leaves holes,
+// so against --no-lod's exact fit a level rasterizes more points, not fewer: 62k against 48k
+// at 80x24, 488k against 298k at 200x60. In return a resize only ever swaps in another
+// level. Levels are built the first time something asks for them, and prefetch() builds the
+// two either side of the current one on a second thread, so the first resize to one of them
+// finds it ready instead of building it in the middle of a frame.
+constexpr int LOD_BASE = 32;
+constexpr int LOD_LEVELS = 13; // 32 .. 2048 cells
+
+inline int lod_cells(int level) {
+  return static_cast<int>(std::lround(LOD_BASE * std::pow(2.0, level / 2.0)));
+}
+
+class MeshLod {
+ public:
+  MeshLod(float density, bool half, const std::string &cache_dir)
+      : density_(density), half_(half), cache_dir_(cache_dir), levels_(LOD_LEVELS), pending_(LOD_LEVELS) {}
+
+  // smallest level that still covers a rows x cols terminal without holes
+  static int level_for(int term_rows, int term_cols) {
+    int need = std::max(term_rows, term_cols);
+    int k = 0;
+    while (k < LOD_LEVELS - 1 && lod_cells(k) < need) k++;
+    return k;
+  }
+
+  // the level asked for, built (or loaded from the cache) now unless prefetch() already has it
+  Mesh &get(int level) {
+    Mesh &m = levels_[level];
+    if (m.count == 0) {
+      m = pending_[level].valid() ? pending_[level].get() : cached_mesh(cache_dir_, key(level));
+    }
+    return m;
+  }
+
+  // start building the neighbours of level in the background. Only get() takes the result,
+  // on the caller's thread, so the levels pipelines render from never change under them.
+  void prefetch(int level) {
+    for (int k : {level - 1, level + 1}) {
+      if (k < 0 || k >= LOD_LEVELS || levels_[k].count != 0 || pending_[k].valid()) continue;
+      pending_[k] = std::async(std::launch::async, [dir = cache_dir_, key = key(k)] { return cached_mesh(dir, key); });
+    }
+  }
+
+ private:
+  float density_;
+  bool half_;
+  std::string cache_dir_;
+  std::vector<Mesh> levels_;
+  std::vector<std::future<Mesh>> pending_; // prefetch() builds still to be taken by get()
+
+  MeshKey key(int level) const {
+    int dim = lod_cells(level);
+    return mesh_key(MeshKind::Parametric, dim, dim, density_, half_);
+  }
+};
+
+// tasks per worker of the threaded rasterizer, enough that one slow worker doesn't hold the
+// frame up without every task shrinking to a handful of blocks
+constexpr std::size_t RASTER_TASKS_PER_WORKER = 4;
+
+// Threaded render_mesh. Mesh chunks go out to the pool, and each worker rasterizes into its
+// own depth/shade buffer (worker 0 straight into fb), clearing it in the first task it takes
+// so the clears run in parallel too. The buffers are then merged in row bands, and the
+// closest point wins each cell. That matches the single-threaded depth test
+// except where depths tie: the merge keeps whichever buffer it reaches first, not the first
+// point in mesh order. With --painter each chunk is painted back to front, but the chunks are
+// still merged by depth, so a tie can land on a different point than one-thread painting.
+template <typename Math = FloatMath, const float *Baked = nullptr>
+void render_mesh_parallel(const Mesh &mesh, const float (&rot)[9], const Projection &proj, FrameBuffer &fb,
+                          RenderPath path, WorkerPool &pool, std::vector<FrameBuffer> &scratch,
+                          FrameArena &arena) {
+  const int workers = pool.size();
+  if (workers == 1) {
+    render_mesh<Math, Baked>(mesh, rot, proj, fb, path);
+    return;
+  }
+  scratch.resize(workers - 1);
+  for (FrameBuffer &local : scratch) local.resize(fb.rows, fb.cols);
+
+  // whole blocks, about RASTER_TASKS_PER_WORKER of them per worker
+  const std::size_t per_task = (mesh.count + workers * RASTER_TASKS_PER_WORKER - 1) / (workers * RASTER_TASKS_PER_WORKER);
+  const std::size_t chunk = std::max<std::size_t>(1, (per_task + RASTER_BLOCK - 1) / RASTER_BLOCK) * RASTER_BLOCK;
+  const int chunks = static_cast<int>((mesh.count + chunk - 1) / chunk);
+  // each worker only writes its own flag, and run() returning orders them before the reads
+  std::uint8_t *cleared = arena.alloc<std::uint8_t>(workers);
+  std::fill(cleared, cleared + workers, 0);
+  pool.run(chunks, [&](int task, int worker) {
+    FrameBuffer &target = worker == 0 ? fb : scratch[worker - 1];
+    if (!cleared[worker]) {
+      Math::clear(target);
+      cleared[worker] = 1;
+    }
+    std::size_t begin = static_cast<std::size_t>(task) * chunk;
+    std::size_t end = std::min(mesh.count, begin + chunk);
+    raster_range<Math, Baked>(mesh, rot, proj, target, path, begin, end);
+  });
+  // a worker that took no task left stale points in its buffer, fb still has to start empty
+  if (!cleared[0]) Math::clear(fb);
+
+  const int bands = std::min(fb.rows, workers * 4);
+  pool.run(bands, [&](int band, int) {
+    std::size_t begin = static_cast<std::size_t>(fb.rows) * band / bands * fb.cols;
+    std::size_t end = static_cast<std::size_t>(fb.rows) * (band + 1) / bands * fb.cols;
+    auto *depth = Math::depth(fb);
+    for (int w = 1; w < workers; w++) {
+      if (!cleared[w]) continue;
+      FrameBuffer &local = scratch[w - 1];
+      const auto *local_depth = Math::depth(local);
+      for (std::size_t i = begin; i < end; i++) {
+        if (local_depth[i] > depth[i]) {
+          depth[i] = local_depth[i];
+          fb.shade[i] = local.shade[i];
+        }
+      }
+    }
+  });
+  for (int w = 1; w < workers; w++) {
+    if (cleared[w]) fb.counts.add(scratch[w - 1].counts);
+  }
+}
+
+// The slice of OpenCL 1.1 the gpu backend uses, declared here and looked up with dlopen at run
+// time, so building needs no OpenCL headers and running needs no OpenCL install.
+namespace cl {
+using Int = std::int32_t;
+using Uint = std::uint32_t;
+using Bitfield = std::uint64_t;
+using Platform = struct _cl_platform_id *;
+using Device = struct _cl_device_id *;
+using Context = struct _cl_context *;
+using Queue = struct _cl_command_queue *;
+using Program = struct _cl_program *;
+using Kernel = struct _cl_kernel *;
+using Mem = struct _cl_mem *;
+using Event = struct _cl_event *;
+
+constexpr Int SUCCESS = 0;
+constexpr Bitfield DEVICE_TYPE_GPU = 1 << 2;
+constexpr Bitfield DEVICE_TYPE_ACCELERATOR = 1 << 3;
+constexpr Bitfield MEM_READ_WRITE = 1 << 0;
+constexpr Bitfield MEM_READ_ONLY = 1 << 2;
+constexpr Uint TRUE = 1;
+constexpr Uint DEVICE_NAME = 0x102B;
+constexpr Uint PROGRAM_BUILD_LOG = 0x1183;
+
+struct Api {
+  Int (*GetPlatformIDs)(Uint, Platform *, Uint *);
+  Int (*GetDeviceIDs)(Platform, Bitfield, Uint, Device *, Uint *);
+  Int (*GetDeviceInfo)(Device, Uint, std::size_t, void *, std::size_t *);
+  Context (*CreateContext)(const std::intptr_t *, Uint, const Device *,
+                           void (*)(const char *, const void *, std::size_t, void *), void *, Int *);
+  Queue (*CreateCommandQueue)(Context, Device, Bitfield, Int *);
+  Program (*CreateProgramWithSource)(Context, Uint, const char **, const std::size_t *, Int *);
+  Int (*BuildProgram)(Program, Uint, const Device *, const char *, void (*)(Program, void *), void *);
+  Int (*GetProgramBuildInfo)(Program, Device, Uint, std::size_t, void *, std::size_t *);
+  Kernel (*CreateKernel)(Program, const char *, Int *);
+  Mem (*CreateBuffer)(Context, Bitfield, std::size_t, void *, Int *);
+  Int (*SetKernelArg)(Kernel, Uint, std::size_t, const void *);
+  Int (*EnqueueNDRangeKernel)(Queue, Kernel, Uint, const std::size_t *, const std::size_t *,
+                              const std::size_t *, Uint, const Event *, Event *);
+  Int (*EnqueueWriteBuffer)(Queue, Mem, Uint, std::size_t, std::size_t, const void *, Uint,
+                            const Event *, Event *);
+  Int (*EnqueueReadBuffer)(Queue, Mem, Uint, std::size_t, std::size_t, void *, Uint,
+                           const Event *, Event *);
+  Int (*ReleaseMemObject)(Mem);
+  Int (*ReleaseKernel)(Kernel);
+  Int (*ReleaseProgram)(Program);
+  Int (*ReleaseCommandQueue)(Queue);
+  Int (*ReleaseContext)(Context);
+};
+
+// the loaded library's entry points, nullptr (and the reason in why) when there's none
+const Api *load(std::string &why) {
+  static Api api;
+  static const char *error = [] () -> const char * {
+    void *lib = dlopen("libOpenCL.so.1", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) lib = dlopen("libOpenCL.so", RTLD_NOW | RTLD_LOCAL);
+    if (!lib) return "no libOpenCL";
+    // POSIX guarantees a data pointer from dlsym converts to a function pointer
+    auto sym = [&](auto &fn, const char *name) {
+      fn = reinterpret_cast<std::remove_reference_t<decltype(fn)>>(dlsym(lib, name));
+      return fn != nullptr;
+    };
+    bool ok = sym(api.GetPlatformIDs, "clGetPlatformIDs") &&
+              sym(api.GetDeviceIDs, "clGetDeviceIDs") &&
+              sym(api.GetDeviceInfo, "clGetDeviceInfo") &&
+              sym(api.CreateContext, "clCreateContext") &&
+              sym(api.CreateCommandQueue, "clCreateCommandQueue") &&
+              sym(api.CreateProgramWithSource, "clCreateProgramWithSource") &&
+              sym(api.BuildProgram, "clBuildProgram") &&
+              sym(api.GetProgramBuildInfo, "clGetProgramBuildInfo") &&
+              sym(api.CreateKernel, "clCreateKernel") &&
+              sym(api.CreateBuffer, "clCreateBuffer") &&
+              sym(api.SetKernelArg, "clSetKernelArg") &&
+              sym(api.EnqueueNDRangeKernel, "clEnqueueNDRangeKernel") &&
+              sym(api.EnqueueWriteBuffer, "clEnqueueWriteBuffer") &&
+              sym(api.EnqueueReadBuffer, "clEnqueueReadBuffer") &&
+              sym(api.ReleaseMemObject, "clReleaseMemObject") &&
+              sym(api.ReleaseKernel, "clReleaseKernel") &&
+              sym(api.ReleaseProgram, "clReleaseProgram") &&
+              sym(api.ReleaseCommandQueue, "clReleaseCommandQueue") &&
+              sym(api.ReleaseContext, "clReleaseContext");
+    return ok ? nullptr : "libOpenCL is missing OpenCL 1.1 entry points";
+  }();
+  if (error) {
+    why = error;
+    return nullptr;
+  }
+  return &api;
+}
+} // namespace cl
+
+// The gpu version of the fused raster kernel, one work item per stored point. Each cell holds
+// a key of quantized depth over shade byte, so atomic_max leaves the nearest point's shade
+// there without a separate depth test, and 0 is an empty cell.
+const char GPU_RASTER_SOURCE[] = R"CL(
+enum { MIRROR = 1, CULL = 2, LAMBERT = 4, PERSPECTIVE = 8 };
+
+__kernel void clear_cells(__global uint *cells, uint n) {
+  uint i = get_global_id(0);
+  if (i < n) cells[i] = 0;
+}
+
+// m is the rotation in s0-s8, then col scale and offset, row scale and offset, camera
+// distance, focal length and depth bias. light is the direction towards the light
+// premultiplied by half the shade levels, and the depth scale in w.
+void plot(float3 p, float3 n, float16 m, float4 light, int rows, int cols, uint flags,
+          __global const uchar *lut, __global uint *cells) {
+  const float3 r0 = m.s012, r1 = m.s345, r2 = m.s678;
+  const float3 q = (float3)(dot(r0, p), dot(r1, p), dot(r2, p));
+  const float3 rn = (float3)(dot(r0, n), dot(r1, n), dot(r2, n));
+  if (flags & CULL) {
+    float facing = (flags & PERSPECTIVE) ? rn.z * (m.sd - q.z) - rn.x * q.x - rn.y * q.y : rn.z;
+    if (facing < 0.0f) return;
+  }
+  float x = q.x, y = q.y;
+  if (flags & PERSPECTIVE) {
+    float w = m.se / fmax(m.sd - q.z, m.se);
+    x *= w;
+    y *= w;
+  }
+  int col = (int)floor(x * m.s9 + m.sa);
+  int row = (int)floor(y * m.sb + m.sc);
+  if (col < 0 || col >= cols || row < 0 || row >= rows) return;
+  // t runs 0..256 from the back of the torus to the front, the depth shade index
+  float t = q.z * light.w + m.sf;
+  int level = (flags & LAMBERT) ? (int)(dot(rn, light.xyz) + m.sf) : (int)t;
+  uint depth = (uint)clamp(t * 65536.0f, 0.0f, 16777215.0f);
+  atomic_max(&cells[row * cols + col], (depth << 8) | lut[clamp(level, 0, 256)]);
+}
+
+__kernel void raster(__global const float *x, __global const float *y, __global const float *z,
+                     __global const float *nx, __global const float *ny, __global const float *nz,
+                     uint count, __global const uchar *lut, __global uint *cells,
+                     float16 m, float4 light, int rows, int cols, uint flags) {
+  uint i = get_global_id(0);
+  if (i >= count) return;
+  float3 p = (float3)(x[i], y[i], z[i]);
+  float3 n = (float3)(nx[i], ny[i], nz[i]);
+  plot(p, n, m, light, rows, cols, flags, lut, cells);
+  if (flags & MIRROR) plot(p * (float3)(1, 1, -1), n * (float3)(1, 1, -1), m, light, rows, cols, flags, lut, cells);
+}
+)CL";
+
+// Rotate, project and depth-test on an OpenCL device, into the same shade frame buffer the
+// cpu raster fills, so encoding and output don't know the difference. The mesh is uploaded
+// once per level of detail; a frame only sends its matrix and reads back one key per cell.
+// Painter's order and tile culling are cpu only, the device always works like the z-buffer.
+class GpuRaster {
+ public:
+  // nullptr with the reason in why when there's no device to run on
+  static std::unique_ptr<GpuRaster> open(std::string &why) {
+    const cl::Api *api = cl::load(why);
+    if (!api) return nullptr;
+    std::unique_ptr<GpuRaster> gpu(new GpuRaster(*api));
+    if (!gpu->init(why)) return nullptr;
+    return gpu;
+  }
+
+  ~GpuRaster() {
+    release_mesh();
+    if (cells_) api_.ReleaseMemObject(cells_);
+    if (lut_) api_.ReleaseMemObject(lut_);
+    if (clear_) api_.ReleaseKernel(clear_);
+    if (raster_) api_.ReleaseKernel(raster_);
+    if (program_) api_.ReleaseProgram(program_);
+    if (queue_) api_.ReleaseCommandQueue(queue_);
+    if (context_) api_.ReleaseContext(context_);
+  }
+
+  GpuRaster(const GpuRaster&) = delete;
+  GpuRaster& operator=(const GpuRaster&) = delete;
+
+  const std::string &device_name() const { return name_; }
+
+  // copy the mesh over, once for every mesh render() is going to see
+  bool upload(const Mesh &mesh) {
+    release_mesh();
+    count_ = mesh.count;
+    mirrored_ = mesh.mirrored;
+    const FloatArray *arrays[6] = {&mesh.x, &mesh.y, &mesh.z, &mesh.nx, &mesh.ny, &mesh.nz};
+    for (int k = 0; k < 6; k++) {
+      std::size_t bytes = std::max<std::size_t>(1, mesh.count) * sizeof(float);
+      cl::Int err = cl::SUCCESS;
+      mesh_[k] = api_.CreateBuffer(context_, cl::MEM_READ_ONLY, bytes, nullptr, &err);
+      if (err != cl::SUCCESS) return failed("clCreateBuffer", err);
+      if (mesh.count > 0) {
+        err = api_.EnqueueWriteBuffer(queue_, mesh_[k], cl::TRUE, 0, mesh.count * sizeof(float),
+                                      arrays[k]->data(), 0, nullptr, nullptr);
+        if (err != cl::SUCCESS) return failed("clEnqueueWriteBuffer", err);
+      }
+    }
+    return true;
+  }
+
+  // one frame of the uploaded mesh into fb, false when the device failed
+  bool render(const float (&rot)[9], const Projection &proj, FrameBuffer &fb) {
+    const cl::Uint cells = static_cast<cl::Uint>(fb.rows) * fb.cols;
+    if (cells > cells_size_) {
+      if (cells_) api_.ReleaseMemObject(cells_);
+      cl::Int err = cl::SUCCESS;
+      cells_ = api_.CreateBuffer(context_, cl::MEM_READ_WRITE, cells * sizeof(cl::Uint), nullptr, &err);
+      if (err != cl::SUCCESS) return failed("clCreateBuffer", err);
+      cells_size_ = cells;
+    }
+    if (!lut_uploaded_) {
+      cl::Int err = api_.EnqueueWriteBuffer(queue_, lut_, cl::TRUE, 0, sizeof(g_params.shade_lut),
+                                            g_params.shade_lut, 0, nullptr, nullptr);
+      if (err != cl::SUCCESS) return failed("clEnqueueWriteBuffer", err);
+      lut_uploaded_ = true;
+    }
+
+    float m[16];
+    std::copy(std::begin(rot), std::end(rot), m);
+    m[9] = proj.col_scale;
+    m[10] = proj.col_offset;
+    m[11] = proj.row_scale;
+    m[12] = proj.row_offset;
+    m[13] = proj.distance;
+    m[14] = proj.focal;
+    m[15] = g_params.depth_bias;
+    const float light[4] = {g_params.light[0] * (SHADE_LEVELS / 2.0f), g_params.light[1] * (SHADE_LEVELS / 2.0f),
+                            g_params.light[2] * (SHADE_LEVELS / 2.0f), g_params.depth_scale};
+    const cl::Uint count = static_cast<cl::Uint>(count_);
+    const cl::Uint flags = (mirrored_ ? 1 : 0) | (g_params.backface_cull ? 2 : 0) |
+                           (g_params.shading == ShadeMode::Lambert ? 4 : 0) | (proj.perspective ? 8 : 0);
+
+    cl::Int err = arg(clear_, 0, cells_) | arg(clear_, 1, cells);
+    for (int k = 0; k < 6; k++) err |= arg(raster_, k, mesh_[k]);
+    err |= arg(raster_, 6, count) | arg(raster_, 7, lut_) | arg(raster_, 8, cells_) |
+           arg(raster_, 9, m) | arg(raster_, 10, light) | arg(raster_, 11, fb.rows) |
+           arg(raster_, 12, fb.cols) | arg(raster_, 13, flags);
+    if (err != cl::SUCCESS) return failed("clSetKernelArg", err);
+    const std::size_t clear_items = cells;
+    err = api_.EnqueueNDRangeKernel(queue_, clear_, 1, nullptr, &clear_items, nullptr, 0, nullptr, nullptr);
+    if (err != cl::SUCCESS) return failed("clEnqueueNDRangeKernel", err);
+    if (count_ > 0) {
+      const std::size_t points = count_;
+      err = api_.EnqueueNDRangeKernel(queue_, raster_, 1, nullptr, &points, nullptr, 0, nullptr, nullptr);
+      if (err != cl::SUCCESS) return failed("clEnqueueNDRangeKernel", err);
+    }
+    keys_.resize(cells);
+    err = api_.EnqueueReadBuffer(queue_, cells_, cl::TRUE, 0, cells * sizeof(cl::Uint), keys_.data(),
+                                 0, nullptr, nullptr);
+    if (err != cl::SUCCESS) return failed("clEnqueueReadBuffer", err);
+
+    fb.counts = RasterCounts{};
+    fb.counts.points = mirrored_ ? 2 * count_ : count_;
+    for (cl::Uint i = 0; i < cells; i++) {
+      fb.shade[i] = static_cast<std::uint8_t>(keys_[i] & 0xff);
+      fb.counts.cells += keys_[i] != 0;
+    }
+    return true;
+  }
+
+ private:
+  explicit GpuRaster(const cl::Api &api) : api_(api) {}
+
+  bool init(std::string &why) {
+    cl::Uint platforms = 0;
+    cl::Platform ids[8];
+    if (api_.GetPlatformIDs(8, ids, &platforms) != cl::SUCCESS || platforms == 0) {
+      why = "no OpenCL platform";
+      return false;
+    }
+    // a gpu anywhere beats an accelerator, cpu devices would only compete with our own threads
+    cl::Device device = nullptr;
+    for (cl::Bitfield type : {cl::DEVICE_TYPE_GPU, cl::DEVICE_TYPE_ACCELERATOR}) {
+      for (cl::Uint p = 0; p < std::min<cl::Uint>(platforms, 8) && !device; p++) {
+        cl::Uint found = 0;
+        if (api_.GetDeviceIDs(ids[p], type, 1, &device, &found) != cl::SUCCESS || found == 0) device = nullptr;
+      }
+      if (device) break;
+    }
+    if (!device) {
+      why = "no OpenCL gpu or accelerator";
+      return false;
+    }
+    char name[256] = {};
+    api_.GetDeviceInfo(device, cl::DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+    name_ = name;
+
+    cl::Int err = cl::SUCCESS;
+    context_ = api_.CreateContext(nullptr, 1, &device, nullptr, nullptr, &err);
+    if (err != cl::SUCCESS) return failed("clCreateContext", err, why);
+    queue_ = api_.CreateCommandQueue(context_, device, 0, &err);
+    if (err != cl::SUCCESS) return failed("clCreateCommandQueue", err, why);
+    const char *source = GPU_RASTER_SOURCE;
+    program_ = api_.CreateProgramWithSource(context_, 1, &source, nullptr, &err);
+    if (err != cl::SUCCESS) return failed("clCreateProgramWithSource", err, why);
+    err = api_.BuildProgram(program_, 1, &device, "-cl-fast-relaxed-math", nullptr, nullptr);
+    if (err != cl::SUCCESS) {
+      std::string log(4096, '\0');
+      std::size_t len = 0;
+      api_.GetProgramBuildInfo(program_, device, cl::PROGRAM_BUILD_LOG, log.size(), &log[0], &len);
+      log.resize(std::min(len, log.size()));
+      why = "kernel build failed: " + log;
+      return false;
+    }
+    clear_ = api_.CreateKernel(program_, "clear_cells", &err);
+    if (err != cl::SUCCESS) return failed("clCreateKernel", err, why);
+    raster_ = api_.CreateKernel(program_, "raster", &err);
+    if (err != cl::SUCCESS) return failed("clCreateKernel", err, why);
+    lut_ = api_.CreateBuffer(context_, cl::MEM_READ_ONLY, sizeof(g_params.shade_lut), nullptr, &err);
+    if (err != cl::SUCCESS) return failed("clCreateBuffer", err, why);
+    return true;
+  }
+
+  template <typename T>
+  cl::Int arg(cl::Kernel kernel, cl::Uint index, const T &value) {
+    return api_.SetKernelArg(kernel, index, sizeof(T), &value);
+  }
+
+  bool failed(const char *call, cl::Int err, std::string &why) {
+    why = std::string(call) + " failed (" + std::to_string(err) + ")";
+    return false;
+  }
+
+  bool failed(const char *call, cl::Int err) {
+    std::string why;
+    failed(call, err, why);
+    std::cerr << "torus: gpu: " << why << "\n";
+    return false;
+  }
+
+  void release_mesh() {
+    for (cl::Mem &m : mesh_) {
+      if (m) api_.ReleaseMemObject(m);
+      m = nullptr;
+    }
+  }
+
+  const cl::Api &api_;
+  std::string name_;
+  cl::Context context_ = nullptr;
+  cl::Queue queue_ = nullptr;
+  cl::Program program_ = nullptr;
+  cl::Kernel clear_ = nullptr;
+  cl::Kernel raster_ = nullptr;
+  cl::Mem lut_ = nullptr;
+  bool lut_uploaded_ = false;
+  cl::Mem mesh_[6] = {}; // x, y, z, nx, ny, nz
+  std::size_t count_ = 0;
+  bool mirrored_ = false;
+  cl::Mem cells_ = nullptr;
+  cl::Uint cells_size_ = 0;
+  std::vector<cl::Uint> keys_; // read back each frame, grows with the frame only
+};
+
+// bit i set when byte i of the 8 at p is nonzero: each byte's high bit is set if any of its
+// bits are, then one multiply gathers the 8 high bits into the top byte (little endian)
+inline unsigned nonzero_bits(const std::uint8_t *p) {
+  const std::uint64_t hi = 0x8080808080808080ull;
+  std::uint64_t w;
+  std::memcpy(&w, p, sizeof(w));
+  w = (((w & ~hi) + ~hi) | w) & hi;
+  return static_cast<unsigned>(((w >> 7) * 0x0102040810204080ull) >> 56);
+}
+
+// lit samples in at most 8 bytes, past the end counts as unlit
+inline unsigned nonzero_bits(const std::uint8_t *p, int count) {
+  if (count >= 8) return nonzero_bits(p);
+  std::uint8_t tail[8] = {};
+  std::memcpy(tail, p, static_cast<std::size_t>(count));
+  return nonzero_bits(tail);
+}
+
+// braille dot bits for the (left, right) sample pair of each row of a cell, dots 1-3 and 4-6
+// run down the first three rows and dots 7 and 8 sit on the fourth
+constexpr std::uint8_t BRAILLE_ROW[4][4] = {
+  {0x00, 0x01, 0x08, 0x09},
+  {0x00, 0x02, 0x10, 0x12},
+  {0x00, 0x04, 0x20, 0x24},
+  {0x00, 0x40, 0x80, 0xc0},
+};
+
+// Fold a frame rasterized at sub-cell resolution down to one mask byte per terminal cell, the
+// index into glyph_table. Samples are tested 8 at a time as whole words, so for braille one
+// word covers a row of 4 cells and for half blocks a row of 8.
+void pack_subcells(const FrameBuffer &sub, FrameBuffer &fb, Glyphs glyphs) {
+  for (int r = 0; r < fb.rows; r++) {
+    std::uint8_t *out = fb.shade.data() + static_cast<std::size_t>(r) * fb.cols;
+    if (glyphs == Glyphs::Braille) {
+      const std::uint8_t *row = sub.shade.data() + static_cast<std::size_t>(4 * r) * sub.cols;
+      for (int c = 0; c < fb.cols; c += 4) {
+        unsigned bits[4];
+        for (int k = 0; k < 4; k++) {
+          bits[k] = nonzero_bits(row + static_cast<std::size_t>(k) * sub.cols + 2 * c, sub.cols - 2 * c);
+        }
+        for (int j = 0; j < 4 && c + j < fb.cols; j++) {
+          out[c + j] = BRAILLE_ROW[0][(bits[0] >> (2 * j)) & 3] | BRAILLE_ROW[1][(bits[1] >> (2 * j)) & 3] |
+                       BRAILLE_ROW[2][(bits[2] >> (2 * j)) & 3] | BRAILLE_ROW[3][(bits[3] >> (2 * j)) & 3];
+        }
+      }
+    } else {
+      const std::uint8_t *top = sub.shade.data() + static_cast<std::size_t>(2 * r) * sub.cols;
+      const std::uint8_t *bottom = top + sub.cols;
+      for (int c = 0; c < fb.cols; c += 8) {
+        unsigned t = nonzero_bits(top + c, fb.cols - c);
+        unsigned b = nonzero_bits(bottom + c, fb.cols - c);
+        for (int j = 0; j < 8 && c + j < fb.cols; j++) {
+          out[c + j] = static_cast<std::uint8_t>(((t >> j) & 1) | (((b >> j) & 1) << 1));
+        }
+      }
+    }
+  }
+}
+
+// Paces the main loop to a target fps against absolute deadlines on the monotonic clock, so
+// oversleeping one frame just shortens the next sleep. The animation time steps one period per
+// frame. When the loop falls more than a frame behind it either drops the missed frames and
+// jumps the animation to the wall clock, or restarts the schedule from now and lets the
+// animation run slow.
+class FrameScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // fps of 0 runs uncapped
+  FrameScheduler(double fps, bool skip_frames)
+      : skip_frames_(skip_frames), start_(Clock::now()), deadline_(start_) {
+    if (fps > 0.0) {
+      period_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / fps));
+    }
+  }
+
+  // animation time of the current frame in seconds, the wall clock when uncapped
+  double frame_time() const {
+    Clock::duration t = period_.count() > 0 ? shown_ : Clock::now() - start_;
+    return std::chrono::duration<double>(t).count();
+  }
+
+  // sleep until the next frame is due, returns how many frames were dropped to catch up
+  int wait() {
+    int dropped = advance();
+    if (period_.count() > 0) std::this_thread::sleep_until(deadline_);
+    return dropped;
+  }
+
+  // step to the next frame's deadline without sleeping, for loops that wait on something else
+  int advance() {
+    if (period_.count() == 0) return 0;
+    deadline_ += period_;
+    shown_ += period_;
+    Clock::time_point now = Clock::now();
+    int dropped = 0;
+    if (now > deadline_ + period_) {
+      if (skip_frames_) {
+        auto behind = (now - deadline_) / period_;
+        deadline_ += behind * period_;
+        shown_ += behind * period_;
+        dropped = static_cast<int>(behind);
+      } else {
+        deadline_ = now;
+      }
+    }
+    return dropped;
+  }
+
+  Clock::time_point deadline() const { return deadline_; }
+
+ private:
+  bool skip_frames_;
+  Clock::duration period_{0};
+  Clock::time_point start_;
+  Clock::time_point deadline_;
+  Clock::duration shown_{0}; // animation time, behind deadline_ - start_ once frames ran late
+};
+
+// DEC private mode 2026, terminals that know it hold the frame until the end marker arrives
+const char SYNC_BEGIN[] = "\033[?2026h";
+const char SYNC_END[] = "\033[?2026l";
+
+// Output stage: encodes a frame into one reusable contiguous buffer and hands it to the
+// terminal with a single write(2), instead of one iostream call per cell.
+struct TermOutput {
+  int fd = STDOUT_FILENO;
+  bool sync = false;
+  bool diff = false;
+  std::string buf; // capacity carries over between frames
+
+  // what the terminal is showing right now, for the diff path
+  std::vector<std::uint8_t> prev;
+  int prev_rows = 0;
+  int prev_cols = 0;
+  bool have_prev = false;
+
+  bool clear_pending = false;
+
+  std::string footer; // resent on the line below the frame with every frame, --stats
+
+  // forget what's on screen, the next frame clears it and goes out in full
+  void invalidate() {
+    have_prev = false;
+    clear_pending = true;
+  }
+
+  void begin_frame() {
+    buf.clear();
+    if (sync) buf += SYNC_BEGIN;
+  }
+
+  void end_frame() {
+    if (sync) buf += SYNC_END;
+  }
+
+  void encode_full(const FrameBuffer &fb) {
+    if (clear_pending) {
+      buf += "\033[2J"; // the old geometry may have left cells outside the new frame
+      clear_pending = false;
+    }
+    buf += "\033[H";  // cursor home (no need to full clear every frame)
+    for (int r = 0; r < fb.rows; ++r) {
+      if (r > 0) buf += '\n'; // no newline after the last row, it would scroll the terminal
+      encode_line(fb, r, buf);
+    }
+  }
+
+  // Only the cells that changed since the last frame, as runs behind cursor-positioning
+  // escapes. Returns false (leaving buf as it was) when the full frame would be smaller.
+  bool encode_diff(const FrameBuffer &fb) {
+    if (!have_prev || prev_rows != fb.rows || prev_cols != fb.cols) {
+      return false;
+    }
+    // an unchanged gap this short is cheaper to resend than to jump over with an escape
+    const int MAX_GAP = 4;
+    const std::size_t start = buf.size();
+    std::size_t full_bytes = 3; // cursor home
+    for (int r = 0; r < fb.rows; ++r) {
+      const std::size_t base = static_cast<std::size_t>(r) * fb.cols;
+      const std::uint8_t *cur = fb.shade.data() + base;
+      const std::uint8_t *old = prev.data() + base;
+      full_bytes += 1; // newline
+      int c = 0;
+      while (c < fb.cols) {
+        full_bytes += cell_bytes(cur[c]);
+        if (cur[c] == old[c]) {
+          c++;
+          continue;
+        }
+        // c starts a changed run, extend it across short unchanged gaps
+        int end = c + 1;
+        int last_changed = c;
+        while (end < fb.cols && end - last_changed <= MAX_GAP) {
+          full_bytes += cell_bytes(cur[end]);
+          if (cur[end] != old[end]) last_changed = end;
+          end++;
+        }
+        append_at_pos(buf, r + 1, c + 1);
+        for (int k = c; k <= last_changed; k++) {
+          append_cell(buf, cur[k]);
+        }
+        c = end;
+      }
+    }
+    if (buf.size() - start > full_bytes) {
+      buf.resize(start);
+      return false;
+    }
+    return true;
+  }
+
+  bool flush() {
+    return write_all(fd, buf.data(), buf.size());
+  }
+
+  void remember(const FrameBuffer &fb) {
+    prev.assign(fb.shade.begin(), fb.shade.end());
+    prev_rows = fb.rows;
+    prev_cols = fb.cols;
+    have_prev = true;
+  }
+
+  // fill buf with the next frame, full or diff
+  void encode(const FrameBuffer &fb) {
+    begin_frame();
+    if (!diff || !encode_diff(fb)) {
+      encode_full(fb);
+    }
+    if (!footer.empty()) {
+      append_at_pos(buf, fb.rows + 1, 1);
+      buf += footer;
+      buf += "\033[K"; // clear whatever the last footer left past this one
+    }
+    end_frame();
+    if (diff) remember(fb);
+  }
+
+  void emit(const FrameBuffer &fb) {
+    encode(fb);
+    flush();
+  }
+};
+
+// Sleep while word holds expected, or until futex_wake. A raw futex, so the handoff below
+// sleeps instead of spinning without either side ever taking a lock.
+static_assert(sizeof(std::atomic<int>) == sizeof(int) && std::atomic<int>::is_always_lock_free,
+              "futexes wait on a plain int");
+
+inline void futex_wait(std::atomic<int> &word, int expected) {
+  syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+}
+
+inline void futex_wake(std::atomic<int> &word) {
+  syscall(SYS_futex, reinterpret_cast<int *>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+// Writes encoded frames to fd from its own thread, for --async. The renderer hands a frame
+// over by swapping its buffer with the one slot, so it can encode frame N+1 while frame N is
+// still going out, and a slow terminal costs max(render, write) per frame instead of their
+// sum. The slot is single producer, single consumer: one atomic state word, and strings
+// swapped rather than copied so their capacity carries over. Frames are never dropped, the
+// diff encoding depends on the terminal seeing every one of them.
+class AsyncWriter {
+ public:
+  explicit AsyncWriter(int fd) : fd_(fd), thread_([this] { loop(); }) {}
+
+  ~AsyncWriter() {
+    wait_for(EMPTY);
+    state_.store(CLOSED, std::memory_order_release);
+    futex_wake(state_);
+    thread_.join();
+  }
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  // queue buf for writing, once the frame before it has been picked up; buf comes back
+  // holding an old frame's storage to encode the next one into
+  void submit(std::string &buf) {
+    wait_for(EMPTY);
+    std::swap(slot_, buf);
+    state_.store(FULL, std::memory_order_release);
+    futex_wake(state_);
+  }
+
+ private:
+  enum { EMPTY, FULL, CLOSED };
+
+  // only the other thread can move state_ off what it is now, so once it reads want it stays
+  void wait_for(int want) {
+    for (int s = state_.load(std::memory_order_acquire); s != want; s = state_.load(std::memory_order_acquire)) {
+      futex_wait(state_, s);
+    }
+  }
+
+  void loop() {
+    std::string sending;
+    while (true) {
+      int s = state_.load(std::memory_order_acquire);
+      if (s == CLOSED) return;
+      if (s == EMPTY) {
+        futex_wait(state_, EMPTY);
+        continue;
+      }
+      std::swap(slot_, sending);
+      state_.store(EMPTY, std::memory_order_release);
+      futex_wake(state_);
+      write_all(fd_, sending.data(), sending.size());
+    }
+  }
+
+  int fd_;
+  std::string slot_;
+  std::atomic<int> state_{EMPTY};
+  std::thread thread_; // last, so it starts after everything it touches
+};
+
+enum Stage { STAGE_ROTATE, STAGE_SORT, STAGE_RASTER, STAGE_ENCODE, STAGE_WRITE, STAGE_COUNT };
+const char *const STAGE_NAMES[STAGE_COUNT] = {"rotate", "sort", "raster", "encode", "write"};
+
+// seconds spent in each stage of one frame
+struct StageTimes {
+  double seconds[STAGE_COUNT] = {};
+};
+
+class StageClock {
+ public:
+  explicit StageClock(StageTimes *times) : times_(times) {
+    if (times_) last_ = std::chrono::steady_clock::now();
+  }
+
+  // charge everything since the last lap to stage
+  void lap(Stage stage) {
+    if (!times_) return;
+    auto now = std::chrono::steady_clock::now();
+    times_->seconds[stage] += std::chrono::duration<double>(now - last_).count();
+    last_ = now;
+  }
+
+ private:
+  StageTimes *times_;
+  std::chrono::steady_clock::time_point last_;
+};
+
+// frame time histogram buckets, bucket k counts frames that took [2^k, 2^(k+1)) us
+constexpr int FRAME_HIST = 24;
+
+// Running totals of the live loop for the --stats line and the SIGUSR1 / exit dump. Only the
+// main thread touches these: workers count into their own frame buffers, and the counts
+// are added up here once per frame, so the hot path has no shared atomics.
+struct Stats {
+  std::uint64_t frames = 0;
+  RasterCounts totals;
+  std::uint64_t bytes = 0;
+  double stage_seconds[STAGE_COUNT] = {};
+  std::uint64_t frame_hist[FRAME_HIST] = {};
+
+  // the last frame alone, and a moving average of the frame rate for the status line
+  RasterCounts last;
+  std::size_t last_bytes = 0;
+  double last_seconds = 0.0;
+  double fps = 0.0;
+  std::chrono::steady_clock::time_point last_start;
+
+  void add(const RasterCounts &counts, const StageTimes &times, std::size_t frame_bytes,
+           std::chrono::steady_clock::time_point start, double seconds) {
+    if (frames > 0) {
+      double interval = std::chrono::duration<double>(start - last_start).count();
+      if (interval > 0.0) fps = fps == 0.0 ? 1.0 / interval : 0.9 * fps + 0.1 / interval;
+    }
+    last_start = start;
+    frames++;
+    totals.add(counts);
+    bytes += frame_bytes;
+    for (int s = 0; s < STAGE_COUNT; s++) stage_seconds[s] += times.seconds[s];
+    std::uint64_t us = static_cast<std::uint64_t>(seconds * 1e6);
+    int k = 0;
+    while (k < FRAME_HIST - 1 && (us >> (k + 1)) != 0) k++;
+    frame_hist[k]++;
+    last = counts;
+    last_bytes = frame_bytes;
+    last_seconds = seconds;
+  }
+
+  // one line that fits under the frame, the previous frame's numbers, into out's capacity
+  void status_line(int width, std::string &out) const {
+    char line[160];
+    int n = std::snprintf(line, sizeof(line),
+                          "%5.1f fps  %6.2f ms  %llu points  %4.1f%% culled  %llu cells  %zu bytes",
+                          fps, last_seconds * 1e3, static_cast<unsigned long long>(last.points),
+                          last.points ? 100.0 * last.culled / last.points : 0.0,
+                          static_cast<unsigned long long>(last.cells), last_bytes);
+    out.assign(line, static_cast<std::size_t>(std::clamp(n, 0, std::min(width, 159))));
+  }
+
+  // everything so far as one JSON object on one line
+  void dump(int fd) const {
+    std::string out = "{\"frames\":";
+    auto field = [&](const char *name, std::uint64_t v) {
+      out += ",\"";
+      out += name;
+      out += "\":";
+      out += std::to_string(v);
+    };
+    out += std::to_string(frames);
+    field("points", totals.points);
+    field("culled", totals.culled);
+    field("cells", totals.cells);
+    field("bytes", bytes);
+    out += ",\"stage_us\":{";
+    for (int s = 0; s < STAGE_COUNT; s++) {
+      if (s > 0) out += ',';
+      out += '"';
+      out += STAGE_NAMES[s];
+      out += "\":";
+      out += std::to_string(static_cast<std::uint64_t>(stage_seconds[s] * 1e6));
+    }
+    out += "},\"frame_us_log2\":[";
+    for (int k = 0; k < FRAME_HIST; k++) {
+      if (k > 0) out += ',';
+      out += std::to_string(frame_hist[k]);
+    }
+    out += "]}\n";
+    write_all(fd, out.data(), out.size());
+  }
+};
+
+// the mirror is rebuilt from the original z, which the in-place rotation overwrites
+inline bool uses_mirror(const Options &opts) {
+  return opts.mirror && !opts.in_place;
+}
+
+Mesh build_mesh(const Options &opts, int term_rows, int term_cols) {
+  return cached_mesh(opts.mesh_cache, mesh_key(opts.mesh, term_rows, term_cols, opts.density, uses_mirror(opts)));
+}
+
+// level of detail only applies to the parametric mesh, and not to --in-place where each
+// mesh carries its own accumulated rotation
+inline bool uses_lod(const Options &opts) {
+  return opts.lod && opts.mesh == MeshKind::Parametric && !opts.in_place;
+}
+
+// Everything one animated view carries between frames: the mesh, its frame buffer and the
+// raster scratch. render() brings fb up to date for animation time t. A pipeline built with
+// share draws from share's meshes instead of building its own; only resize() ever adds to
+// them, so any number of pipelines can render from the same meshes at once.
+struct Pipeline {
+  const Options &opts;
+  MeshLod lod;
+  MeshLod *levels = &lod; // lod, or the one being shared
+  Mesh own; // the one mesh when level of detail is off
+  Mesh *mesh = nullptr;
+  int level = 0; // of levels that mesh is, with level of detail on
+  FrameBuffer fb;
+  FrameBuffer sub; // the sample grid behind fb with --subcell, packed into fb after raster
+  std::vector<FrameBuffer> scratch;
+  FrameArena arena; // temporaries of one render()
+  double last_time = 0.0;
+  int across = 1; // samples per cell
+  int down = 1;
+  float aspect = CELL_ASPECT; // of one sample
+  bool fixed = false; // rasterize with FixedMath
+  std::unique_ptr<GpuRaster> gpu; // --gpu, while the device keeps working
+  const Mesh *gpu_mesh = nullptr; // what the device holds
+
+  Pipeline(const Options &o, int term_rows, int term_cols, Pipeline *share = nullptr)
+      : opts(o), lod(o.density, uses_mirror(o), o.mesh_cache) {
+    subcell_size(g_params.glyphs, across, down);
+    update_aspect();
+    // the fixed-point copy of the mesh is made once, so it can't follow an in-place rotation
+    fixed = g_params.fixed_point && !opts.in_place && !g_params.perspective && !g_params.tile_cull;
+    if (opts.gpu) {
+      // the device keeps its own copy of the mesh, the same reason in-place stays on the cpu
+      std::string why = opts.path == RenderPath::Painter ? "--painter sorts the mesh on the cpu"
+                        : opts.in_place ? "--in-place rotates the mesh on the cpu" : "";
+      if (!opts.in_place) gpu = GpuRaster::open(why);
+      if (gpu) {
+        fixed = false;
+      } else {
+        std::cerr << "torus: --gpu: " << why << ", rasterizing on the cpu\n";
+      }
+    }
+    int rows, cols;
+    mesh_size(term_rows, term_cols, rows, cols);
+    if (share) {
+      levels = share->levels;
+      mesh = share->mesh;
+    } else if (uses_lod(opts)) {
+      lod.get(MeshLod::level_for(rows, cols));
+    } else {
+      own = build_mesh(opts, rows, cols);
+      mesh = &own;
+    }
+    resize(term_rows, term_cols);
+  }
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+  bool subcell() const { return across * down > 1; }
+
+  // one sample's shape, from opts.aspect, which the live loop updates when the terminal's changes
+  void update_aspect() {
+    aspect = (opts.aspect > 0.0f ? opts.aspect : CELL_ASPECT) * down / across;
+  }
+
+  // what the last render() did, counted where the mesh was rasterized
+  const RasterCounts &counts() const { return subcell() ? sub.counts : fb.counts; }
+
+  // samples the torus actually covers on a term_rows x term_cols terminal, what the mesh
+  // density is sized for. The camera keeps it round, so only the tighter axis is filled.
+  void mesh_size(int term_rows, int term_cols, int &rows, int &cols) const {
+    rows = term_rows * down;
+    cols = term_cols * across;
+    if (g_params.perspective) {
+      float s = std::min(rows - 1.0f, (cols - 1.0f) * aspect);
+      rows = static_cast<int>(std::ceil(s)) + 1;
+      cols = static_cast<int>(std::ceil(s / aspect)) + 1;
+    }
+  }
+
+  // New terminal geometry. The buffers are resized in place and the projection follows
+  // from them; the mesh is only swapped for another precomputed level of detail.
+  void resize(int term_rows, int term_cols) {
+    update_aspect();
+    fb.resize(term_rows, term_cols);
+    if (subcell()) sub.resize(term_rows * down, term_cols * across);
+    if (uses_lod(opts)) {
+      int rows, cols;
+      mesh_size(term_rows, term_cols, rows, cols);
+      level = MeshLod::level_for(rows, cols);
+      mesh = &levels->get(level);
+    }
+    if (fixed) mesh->quantize();
+    if (gpu && mesh != gpu_mesh) {
+      gpu_mesh = mesh;
+      if (!gpu->upload(*mesh)) drop_gpu();
+    }
+  }
+
+  // for a view whose size can change: have the levels a resize from here would pick built ahead
+  void prefetch() {
+    if (uses_lod(opts)) levels->prefetch(level);
+  }
+
+  void drop_gpu() {
+    std::cerr << "torus: gpu failed, rasterizing on the cpu from here on\n";
+    gpu.reset();
+    gpu_mesh = nullptr;
+  }
+
+  // the frame on the device, false when it's the cpu's to do
+  bool render_gpu(const float (&rot)[9], const Projection &proj, FrameBuffer &target) {
+    if (!gpu) return false;
+    if (gpu->render(rot, proj, target)) return true;
+    drop_gpu();
+    return false;
+  }
+
+  void render(double t, WorkerPool &pool, StageTimes *times = nullptr) {
+    StageClock clock(times);
+    // every loop that drives a pipeline starts its frame here, so this is where the arena
+    // from the last frame gets handed back
+    arena.reset();
+    float rot[9];
+    if (!opts.in_place) {
+      time_rotation(t, rot);
+    } else {
+      // step the mesh by however far the animation moved since the last frame
+      float step[9];
+      axis_angle_matrix(g_params.spin.axis, (t - last_time) * SPIN_FPS * g_params.spin.angle, step);
+      rotate_mesh(*mesh, step);
+      clock.lap(STAGE_ROTATE);
+      if (opts.path == RenderPath::Painter) {
+        sort_mesh(*mesh, arena);
+        clock.lap(STAGE_SORT);
+      }
+      std::copy(std::begin(IDENTITY), std::end(IDENTITY), rot);
+    }
+    last_time = t;
+    FrameBuffer &target = subcell() ? sub : fb;
+    const Projection proj = Projection::make(target.rows, target.cols, aspect);
+    if (render_gpu(rot, proj, target)) {
+      // done on the device
+    } else if (fixed) {
+      render_mesh_parallel<FixedMath>(*mesh, rot, proj, target, opts.path, pool, scratch, arena);
+    } else if (opts.in_place) {
+      // the mesh already carries the rotation, so the kernel's matrix folds away
+      render_mesh_parallel<FloatMath, IDENTITY>(*mesh, rot, proj, target, opts.path, pool, scratch, arena);
+    } else {
+      render_mesh_parallel(*mesh, rot, proj, target, opts.path, pool, scratch, arena);
+    }
+    if (subcell()) pack_subcells(sub, fb, g_params.glyphs);
+    clock.lap(STAGE_RASTER);
+  }
+};
+
+double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0.0;
+  std::size_t k = static_cast<std::size_t>(p * (v.size() - 1) + 0.5);
+  std::nth_element(v.begin(), v.begin() + k, v.end());
+  return v[k];
+}
+
+// Headless benchmark: runs the pipeline the other options select for --frames frames at
+// --size, encoding each frame but never writing it, and reports per-stage latency.
+int run_bench(const Options &opts) {
+  using Clock = std::chrono::steady_clock;
+  int rows, cols;
+  default_size(opts, 60, 200, rows, cols);
+
+  auto t0 = Clock::now();
+  Pipeline pipe(opts, rows, cols);
+  double init_seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  WorkerPool pool(opts.threads);
+  TermOutput out;
+  out.sync = opts.sync;
+  out.diff = opts.diff;
+
+  std::vector<double> stage[STAGE_COUNT];
+  std::vector<double> frame;
+  std::size_t bytes = 0;
+  for (int f = 0; f < opts.frames; f++) {
+    StageTimes times;
+    auto start = Clock::now();
+    pipe.render(f / SPIN_FPS, pool, &times);
+    StageClock clock(&times);
+    out.encode(pipe.fb);
+    clock.lap(STAGE_ENCODE);
+    frame.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    for (int s = 0; s < STAGE_COUNT; s++) stage[s].push_back(times.seconds[s]);
+    bytes += out.buf.size();
+  }
+
+  double total = 0.0;
+  for (double d : frame) total += d;
+  const int frames = std::max(1, opts.frames);
+  std::printf("bench %dx%d, %zu points, %d frames, kernel %s, %d threads, %s%s%s%s%s\n",
+              cols, rows, pipe.mesh->drawn(), opts.frames,
+              pipe.gpu ? "opencl" : pipe.fixed ? "fixed" : rotate_kernel_name(),
+              pool.size(), opts.path == RenderPath::Painter ? "painter" : "zbuffer",
+              opts.in_place ? ", in-place" : "", opts.diff ? ", diff" : "",
+              g_params.fixed_point && !pipe.fixed && !pipe.gpu ? ", float fallback" : "",
+              opts.gpu && !pipe.gpu ? ", cpu fallback" : "");
+  if (pipe.gpu) std::printf("  %-8s %s\n", "device", pipe.gpu->device_name().c_str());
+  std::printf("  %-8s %10.1f us (once)\n", "init", init_seconds * 1e6);
+  std::printf("  %-8s %10s %10s\n", "stage", "p50 us", "p99 us");
+  for (int s = 0; s < STAGE_COUNT; s++) {
+    if (s == STAGE_WRITE) continue; // headless, nothing is written
+    std::printf("  %-8s %10.1f %10.1f\n", STAGE_NAMES[s],
+                percentile(stage[s], 0.5) * 1e6, percentile(stage[s], 0.99) * 1e6);
+  }
+  std::printf("  %-8s %10.1f %10.1f\n", "frame", percentile(frame, 0.5) * 1e6, percentile(frame, 0.99) * 1e6);
+  std::printf("  points/sec  %.3g\n", total > 0.0 ? pipe.mesh->drawn() * static_cast<double>(frames) / total : 0.0);
+  std::printf("  bytes/frame %zu\n", bytes / frames);
+
+  if (pipe.fixed) {
+    // Q16.16 rounding may move a point across a cell edge or flip a near depth tie, so it
+    // agrees with float cell for cell only within a small tolerance
+    const double TOLERANCE = 0.005;
+    auto compare = [&](Pipeline &fixed, const char *label) {
+      Pipeline ref(opts, rows, cols, &fixed);
+      ref.fixed = false;
+      std::size_t differ = 0;
+      std::size_t lit = 0;
+      for (int f = 0; f < opts.frames; f++) {
+        fixed.render(f / SPIN_FPS, pool);
+        ref.render(f / SPIN_FPS, pool);
+        for (std::size_t i = 0; i < ref.fb.shade.size(); i++) {
+          differ += fixed.fb.shade[i] != ref.fb.shade[i];
+          lit += ref.fb.shade[i] != 0;
+        }
+      }
+      const double ratio = lit > 0 ? static_cast<double>(differ) / lit : 0.0;
+      std::printf("  %-11s %zu of %zu lit cells differ (%.3f%%), %s\n", label, differ, lit, ratio * 100.0,
+                  ratio <= TOLERANCE ? "ok" : "over tolerance");
+      return ratio <= TOLERANCE;
+    };
+    if (!compare(pipe, "vs float")) return 1;
+#ifndef TORUS_FIXED_PARAMS
+    // the same torus a thousand times smaller, positions are quantized over max_x_y so the
+    // fixed path has to agree just as well there
+    const float major = g_params.major_radius, minor = g_params.minor_radius;
+    g_params.major_radius = major / 1000.0f;
+    g_params.minor_radius = minor / 1000.0f;
+    g_params.update();
+    bool ok;
+    {
+      Pipeline small(opts, rows, cols);
+      ok = compare(small, "small radii");
+    }
+    g_params.major_radius = major;
+    g_params.minor_radius = minor;
+    g_params.update();
+    if (!ok) return 1;
+#endif
+  }
+  return 0;
+}
+
+// everything that changes the bytes of a cached cycle, a stale cache file won't match it
+struct CycleKey {
+  std::uint32_t version = 5;
+  std::int32_t rows = 0;
+  std::int32_t cols = 0;
+  std::int32_t frames = 0;
+  float major_radius = 0.0f;
+  float minor_radius = 0.0f;
+  float theta = 0.0f;
+  std::int32_t num_points = 0;
+  std::uint32_t symbols_hash = 0;
+  float density = 1.0f;
+  std::uint8_t mesh = 0;
+  std::uint8_t path = 0;
+  std::uint8_t in_place = 0;
+  std::uint8_t diff = 0;
+  std::uint8_t sync = 0;
+  std::uint8_t lod = 0;
+  std::uint8_t shading = 0;
+  std::uint8_t mirror = 0;
+  std::uint8_t cull = 0; // bit 0 backface, bit 1 tiles
+  std::uint8_t glyphs = 0;
+  std::uint8_t perspective = 0;
+  std::uint8_t fixed_point = 0;
+  float light[3] = {};
+  float camera_distance = 0.0f;
+  float aspect = 0.0f;
+};
+
+const char CYCLE_MAGIC[8] = {'T', 'O', 'R', 'U', 'S', 'C', 'Y', 'C'};
+
+// One full turn of the animation, encoded once and then replayed. Slot 0 is frame 0 drawn in
+// full, slot k (1..frames) moves the screen from frame k - 1 to frame k % frames, so playback
+// is slot 0 followed by slots 1..frames over and over. With --diff the slots are diff streams.
+// The bytes either live in storage or in a read-only mapping of the cache file.
+class FrameCycle {
+ public:
+  FrameCycle() = default;
+  FrameCycle(const FrameCycle&) = delete;
+  FrameCycle& operator=(const FrameCycle&) = delete;
+  ~FrameCycle() { unmap(); }
+
+  int frames() const { return frames_; }
+
+  const char *slot(int k, std::size_t &len) const {
+    len = offsets_[k + 1] - offsets_[k];
+    return bytes_ + offsets_[k];
+  }
+
+  // frame count that closes one turn at fps, the step is then 2pi / frames exactly
+  static int turn_frames(double fps) {
+    double step = SPIN_FPS * g_params.spin.angle / fps;
+    return std::max(1, static_cast<int>(std::lround(2.0 * M_PI / step)));
+  }
+
+  void render(const Options &opts, int rows, int cols, double fps) {
+    unmap();
+    frames_ = turn_frames(fps);
+    Pipeline pipe(opts, rows, cols);
+    WorkerPool pool(opts.threads);
+    TermOutput out;
+    out.sync = opts.sync;
+    out.diff = opts.diff;
+    // animation time at which the turn is k / frames of the way round
+    const double t_step = 2.0 * M_PI / (frames_ * SPIN_FPS * g_params.spin.angle);
+    storage_offsets_.assign(1, 0);
+    storage_.clear();
+    for (int k = 0; k <= frames_; k++) {
+      pipe.render((k % frames_) * t_step, pool);
+      out.encode(pipe.fb);
+      storage_ += out.buf;
+      storage_offsets_.push_back(storage_.size());
+    }
+    bytes_ = storage_.data();
+    offsets_ = storage_offsets_.data();
+  }
+
+  // write the cycle to path, behind a header keyed on what produced it
+  bool save(const char *path, const CycleKey &key) const {
+    std::string tmp = std::string(path) + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write_all(fd, CYCLE_MAGIC, sizeof(CYCLE_MAGIC)) &&
+              write_all(fd, reinterpret_cast<const char *>(&key), sizeof(key)) &&
+              write_all(fd, reinterpret_cast<const char *>(offsets_), sizeof(std::uint64_t) * (frames_ + 2)) &&
+              write_all(fd, bytes_, offsets_[frames_ + 1]);
+    ok = ::close(fd) == 0 && ok;
+    if (ok) ok = ::rename(tmp.c_str(), path) == 0;
+    if (!ok) ::unlink(tmp.c_str());
+    return ok;
+  }
+
+  // map a cache written by save(), false if it's missing or was made for something else
+  bool load(const char *path, const CycleKey &key) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    const std::size_t size = static_cast<std::size_t>(st.st_size);
+    const std::size_t header = sizeof(CYCLE_MAGIC) + sizeof(CycleKey);
+    void *map = size > header ? ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const char *base = static_cast<const char *>(map);
+    const std::size_t table = sizeof(std::uint64_t) * (key.frames + 2);
+    bool ok = std::memcmp(base, CYCLE_MAGIC, sizeof(CYCLE_MAGIC)) == 0 &&
+              std::memcmp(base + sizeof(CYCLE_MAGIC), &key, sizeof(key)) == 0 &&
+              size >= header + table;
+    if (ok) {
+      const std::uint64_t *offsets = reinterpret_cast<const std::uint64_t *>(base + header);
+      ok = offsets[0] == 0 && offsets[key.frames + 1] == size - header - table;
+      for (int k = 0; ok && k <= key.frames; k++) ok = offsets[k] <= offsets[k + 1];
+    }
+    if (!ok) {
+      ::munmap(map, size);
+      return false;
+    }
+    unmap();
+    map_ = map;
+    map_size_ = size;
+    frames_ = key.frames;
+    offsets_ = reinterpret_cast<const std::uint64_t *>(base + header);
+    bytes_ = base + header + table;
+    return true;
+  }
+
+ private:
+  void unmap() {
+    if (map_) ::munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+  }
+
+  int frames_ = 0;
+  std::string storage_;
+  std::vector<std::uint64_t> storage_offsets_;
+  const char *bytes_ = nullptr;
+  const std::uint64_t *offsets_ = nullptr;
+  void *map_ = nullptr;
+  std::size_t map_size_ = 0;
+};
+
+CycleKey cycle_key(const Options &opts, int rows, int cols, double fps) {
+  CycleKey key;
+  key.rows = rows;
+  key.cols = cols;
+  key.frames = FrameCycle::turn_frames(fps);
+  key.major_radius = g_params.major_radius;
+  key.minor_radius = g_params.minor_radius;
+  key.theta = g_params.theta;
+  key.num_points = g_params.num_points;
+  key.symbols_hash = 2166136261u; // fnv-1a over the ramp, with a separator per symbol
+  for (const std::string &sym : g_params.symbols) {
+    for (unsigned char ch : sym) key.symbols_hash = (key.symbols_hash ^ ch) * 16777619u;
+    key.symbols_hash = (key.symbols_hash ^ 0xffu) * 16777619u;
+  }
+  key.density = opts.density;
+  key.mesh = static_cast<std::uint8_t>(opts.mesh);
+  key.path = static_cast<std::uint8_t>(opts.path);
+  key.in_place = opts.in_place;
+  key.diff = opts.diff;
+  key.sync = opts.sync;
+  key.lod = uses_lod(opts);
+  key.mirror = uses_mirror(opts);
+  key.cull = (g_params.backface_cull ? 1 : 0) | (g_params.tile_cull ? 2 : 0);
+  key.shading = static_cast<std::uint8_t>(g_params.shading);
+  key.glyphs = static_cast<std::uint8_t>(g_params.glyphs);
+  key.perspective = g_params.perspective;
+  key.fixed_point = g_params.fixed_point;
+  if (g_params.perspective) {
+    key.camera_distance = g_params.camera_distance;
+    key.aspect = opts.aspect;
+  }
+  std::copy(std::begin(g_params.light), std::end(g_params.light), key.light);
+  return key;
+}
+
+volatile std::sig_atomic_t g_resized = 0;
+volatile std::sig_atomic_t g_dump_stats = 0;
+volatile std::sig_atomic_t g_quit = 0;
+
+void on_sigusr1(int) {
+  g_dump_stats = 1;
+}
+
+void on_quit(int) {
+  g_quit = 1;
+}
+
+// SIGUSR1 asks for a stats dump, SIGINT and SIGTERM end the live loop so the totals get out
+void install_stats_handlers() {
+  struct sigaction sa{};
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sa.sa_handler = on_sigusr1;
+  sigaction(SIGUSR1, &sa, nullptr);
+  sa.sa_handler = on_quit;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+}
+
+void on_sigwinch(int) {
+  g_resized = 1;
+}
+
+void install_resize_handler() {
+  struct sigaction sa{};
+  sa.sa_handler = on_sigwinch;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART;
+  sigaction(SIGWINCH, &sa, nullptr);
+}
+
+// true and the new size when a SIGWINCH came in since the last call and the geometry really
+// changed, an explicit --size pins the frame and ignores resizes
+// cell width over height from the pixel size of the text area, 0 when the tty doesn't say
+float tty_aspect(const struct winsize &w) {
+  if (w.ws_xpixel == 0 || w.ws_ypixel == 0 || w.ws_row == 0 || w.ws_col == 0) return 0.0f;
+  return (static_cast<float>(w.ws_xpixel) / w.ws_col) / (static_cast<float>(w.ws_ypixel) / w.ws_row);
+}
+
+// aspect, when given, follows the terminal's cell shape too: a font change can keep the
+// size in cells and still reshape the cells
+bool poll_resize(const Options &opts, int &rows, int &cols, float *aspect = nullptr) {
+  if (!g_resized) return false;
+  g_resized = 0;
+  struct winsize w{};
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &w) != 0 || w.ws_row == 0 || w.ws_col == 0) return false;
+  bool changed = false;
+  if (aspect) {
+    float a = tty_aspect(w);
+    if (a > 0.0f && a != *aspect) {
+      *aspect = a;
+      changed = true;
+    }
+  }
+  if (opts.rows > 0 || opts.cols > 0) return changed;
+  if (w.ws_row == rows && w.ws_col == cols) return changed;
+  rows = w.ws_row;
+  cols = w.ws_col;
+  return true;
+}
+
+// Replay a precomputed turn at --fps, rendering (and saving) it first if there's no cache
+// for this exact setup. After start-up the loop is one write per frame and a sleep.
+int run_cycle(const Options &opts, int rows, int cols) {
+  const double fps = opts.fps > 0.0 ? opts.fps : SPIN_FPS;
+  FrameCycle cycle;
+  auto prepare = [&] {
+    const CycleKey key = cycle_key(opts, rows, cols, fps);
+    if (opts.cache_path.empty() || !cycle.load(opts.cache_path.c_str(), key)) {
+      cycle.render(opts, rows, cols, fps);
+      if (!opts.cache_path.empty() && !cycle.save(opts.cache_path.c_str(), key)) {
+        std::cerr << "torus: can't write cache " << opts.cache_path << ": " << std::strerror(errno) << "\n";
+      }
+    }
+  };
+  prepare();
+
+  // the turn was cut into frames at fps, so replay at that too: uncapped would only spin a
+  // core redrawing cached frames faster than the animation was sampled
+  FrameScheduler scheduler(fps, opts.skip_frames);
+  std::size_t len;
+  const char *bytes = cycle.slot(0, len);
+  write_all(STDOUT_FILENO, bytes, len);
+  for (int k = 0; ; ) {
+    const int dropped = scheduler.wait();
+    if (poll_resize(opts, rows, cols)) {
+      // a different size is a different turn, start it over from its full first frame
+      prepare();
+      write_all(STDOUT_FILENO, "\033[2J", 4);
+      bytes = cycle.slot(0, len);
+      write_all(STDOUT_FILENO, bytes, len);
+      k = 0;
+      continue;
+    }
+    // full frames can be skipped, but each diff stream only applies on top of the one before,
+    // so with --diff the dropped slots are still written, back to back without waiting
+    for (int i = 0; i <= dropped; i++) {
+      k = k % cycle.frames() + 1;
+      if (opts.diff || i == dropped) {
+        bytes = cycle.slot(k, len);
+        write_all(STDOUT_FILENO, bytes, len);
+      }
+    }
+  }
+  return 0;
+}
+
+// append s as the body of a JSON string, newlines become \r\n the way a tty's onlcr would
+// have turned them, since cast players take the bytes as they are
+void append_json_escaped(std::string &out, const std::string &s) {
+  static const char HEX[] = "0123456789abcdef";
+  for (unsigned char ch : s) {
+    if (ch == '"' || ch == '\\') {
+      out += '\\';
+      out += static_cast<char>(ch);
+    } else if (ch == '\n') {
+      out += "\\r\\n";
+    } else if (ch < 0x20) {
+      out += "\\u00";
+      out += HEX[ch >> 4];
+      out += HEX[ch & 0xf];
+    } else {
+      out += static_cast<char>(ch); // UTF-8 passes through as is
+    }
+  }
+}
+
+// Offscreen rendering: --frames frames at an explicit size, written to --out as fast as the
+// raster core goes. Animation time still advances at --fps so the playback speed is right.
+int run_headless(const Options &opts) {
+  int rows, cols;
+  default_size(opts, 24, 80, rows, cols);
+  int fd = STDOUT_FILENO;
+  if (opts.out_path != "-") {
+    fd = ::open(opts.out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      std::cerr << "torus: can't open " << opts.out_path << ": " << std::strerror(errno) << "\n";
+      return 1;
+    }
+  }
+
+  Pipeline pipe(opts, rows, cols);
+  WorkerPool pool(opts.threads);
+  TermOutput out;
+  out.fd = fd;
+  out.sync = opts.sync;
+  out.diff = opts.diff;
+
+  const double fps = opts.fps > 0.0 ? opts.fps : SPIN_FPS;
+  std::string line;
+  bool ok = true;
+  if (opts.format == HeadlessFormat::Cast) {
+    line = "{\"version\":3,\"term\":{\"cols\":";
+    append_int(line, cols);
+    line += ",\"rows\":";
+    append_int(line, rows);
+    line += "}}\n";
+    // clear once up front, every frame after that starts from cursor home
+    line += "[0.000, \"o\", \"\\u001b[2J\"]\n";
+    ok = write_all(fd, line.data(), line.size());
+  }
+  char interval[32];
+  std::snprintf(interval, sizeof(interval), "[%.3f, \"o\", \"", 1.0 / fps);
+
+  for (int f = 0; f < opts.frames && ok; f++) {
+    pipe.render(f / fps, pool);
+    switch (opts.format) {
+      case HeadlessFormat::Raw:
+        ok = write_all(fd, reinterpret_cast<const char *>(pipe.fb.shade.data()), pipe.fb.shade.size());
+        break;
+      case HeadlessFormat::Ansi:
+        out.encode(pipe.fb);
+        ok = out.flush();
+        break;
+      case HeadlessFormat::Cast:
+        out.encode(pipe.fb);
+        line.clear();
+        line += interval;
+        append_json_escaped(line, out.buf);
+        line += "\"]\n";
+        ok = write_all(fd, line.data(), line.size());
+        break;
+    }
+  }
+  if (fd != STDOUT_FILENO) ::close(fd);
+  if (!ok) {
+    std::cerr << "torus: write to " << opts.out_path << " failed: " << std::strerror(errno) << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// the size given for a viewport, else what its tty reports, else 80x24
+void viewport_size(const ViewportSpec &spec, int fd, int &rows, int &cols) {
+  struct winsize w{};
+  if (spec.rows == 0 && ioctl(fd, TIOCGWINSZ, &w) == 0 && w.ws_row > 0 && w.ws_col > 0) {
+    rows = w.ws_row;
+    cols = w.ws_col;
+  } else {
+    rows = spec.rows > 0 ? spec.rows : 24;
+    cols = spec.cols > 0 ? spec.cols : 80;
+  }
+}
+
+// One --viewport output: its own size, phase, frame buffer and terminal state, with meshes
+// shared with the first viewport.
+struct Viewport {
+  ViewportSpec spec;
+  int fd;
+  bool follow; // ask the tty for its size every frame
+  int rows;
+  int cols;
+  Pipeline pipe;
+  WorkerPool serial{1}; // each viewport is already one task of the shared pool
+  TermOutput out;
+  bool alive = true;
+
+  Viewport(const Options &opts, const ViewportSpec &s, int f, int r, int c, Pipeline *share)
+      : spec(s), fd(f), follow(s.rows == 0 && ::isatty(f)), rows(r), cols(c),
+        pipe(opts, r, c, share) {
+    if (follow) pipe.prefetch();
+    out.fd = fd;
+    out.sync = opts.sync;
+    out.diff = opts.diff;
+  }
+
+  // true when the tty changed size since the last frame
+  bool poll_size() {
+    if (!follow) return false;
+    int new_rows, new_cols;
+    viewport_size(spec, fd, new_rows, new_cols);
+    if (new_rows == rows && new_cols == cols) return false;
+    rows = new_rows;
+    cols = new_cols;
+    return true;
+  }
+};
+
+// Draw to every --viewport at once. The mesh levels are built once for all of them, and each
+// frame every viewport renders, encodes and writes as one task of the pool. A viewport whose
+// write fails (the reader went away) is dropped, and the run ends when none are left.
+int run_viewports(const Options &opts) {
+  std::signal(SIGPIPE, SIG_IGN); // a closed fifo should fail the write, not end the process
+  std::deque<Viewport> views;
+  for (const ViewportSpec &spec : opts.viewports) {
+    int fd = STDOUT_FILENO;
+    if (spec.path != "-") {
+      fd = ::open(spec.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOCTTY, 0644);
+      if (fd < 0) {
+        std::cerr << "torus: can't open " << spec.path << ": " << std::strerror(errno) << "\n";
+        return 1;
+      }
+    }
+    int rows, cols;
+    viewport_size(spec, fd, rows, cols);
+    views.emplace_back(opts, spec, fd, rows, cols, views.empty() ? nullptr : &views.front().pipe);
+  }
+
+  WorkerPool pool(opts.threads);
+  FrameScheduler scheduler(opts.fps, opts.skip_frames);
+  const double turn = 2.0 * M_PI / (SPIN_FPS * g_params.spin.angle); // seconds per turn
+  std::size_t live = views.size();
+  while (live > 0) {
+    // sizes are settled here on the main thread, so the shared meshes don't change under a task
+    for (Viewport &v : views) {
+      if (v.alive && v.poll_size()) {
+        v.pipe.resize(v.rows, v.cols);
+        v.pipe.prefetch();
+        v.out.invalidate();
+      }
+    }
+    const double t = scheduler.frame_time();
+    pool.run(static_cast<int>(views.size()), [&](int k, int) {
+      Viewport &v = views[k];
+      if (!v.alive) return;
+      v.pipe.render(t + v.spec.phase * turn, v.serial);
+      v.out.encode(v.pipe.fb);
+      v.alive = v.out.flush();
+    });
+    live = std::count_if(views.begin(), views.end(), [](const Viewport &v) { return v.alive; });
+    scheduler.wait();
+  }
+  for (const Viewport &v : views) {
+    if (v.fd != STDOUT_FILENO) ::close(v.fd);
+  }
+  return 0;
+}
+
+// One viewer of --serve. A frame is encoded once and shared by every client it goes to, each
+// client only keeps hold of the one it's still sending.
+struct Client {
+  std::shared_ptr<const std::string> frame; // in flight, null when the client is idle
+  std::size_t sent = 0; // bytes of prefix then frame already out
+  const char *prefix = ""; // sent ahead of the frame
+  std::size_t prefix_len = 0;
+  bool synced = false; // showing the previous frame, so a diff brings it up to date
+  bool want_out = false; // registered for EPOLLOUT
+};
+
+const char CLEAR_SCREEN[] = "\033[2J";
+
+// Send as much of the client's frame as the socket takes without blocking, then only ask
+// epoll for writability while something is left. False when the client is gone.
+bool pump_client(int epfd, int fd, Client &c) {
+  while (c.frame) {
+    const std::string &f = *c.frame;
+    iovec iov[2];
+    int count = 0;
+    if (c.sent < c.prefix_len) {
+      iov[count++] = {const_cast<char *>(c.prefix + c.sent), c.prefix_len - c.sent};
+    }
+    std::size_t off = c.sent > c.prefix_len ? c.sent - c.prefix_len : 0;
+    iov[count++] = {const_cast<char *>(f.data() + off), f.size() - off};
+    msghdr msg{};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return false;
+    }
+    c.sent += static_cast<std::size_t>(n);
+    if (c.sent == c.prefix_len + f.size()) {
+      c.frame.reset();
+      c.sent = 0;
+      c.prefix_len = 0;
+    }
+  }
+  bool want = c.frame != nullptr;
+  if (want != c.want_out) {
+    epoll_event ev{};
+    ev.events = EPOLLIN | (want ? EPOLLOUT : 0u);
+    ev.data.fd = fd;
+    if (::epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev) != 0) return false;
+    c.want_out = want;
+  }
+  return true;
+}
+
+// Streaming server: renders each frame once, diff-encodes it once and hands the same bytes to
+// every connected client over non-blocking sockets driven by epoll. A client still sending an
+// older frame when a new one is ready skips it, so slow viewers lose frames instead of
+// holding up the loop, and get a full frame once they catch up. New clients start with a
+// clear screen and a full frame. Nothing is rendered while nobody is watching.
+int run_server(const Options &opts) {
+  int rows, cols;
+  default_size(opts, 24, 80, rows, cols);
+  int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int one = 1;
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(static_cast<std::uint16_t>(opts.port));
+  if (listen_fd < 0 ||
+      ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+      ::bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+      ::listen(listen_fd, SOMAXCONN) != 0) {
+    std::cerr << "torus: can't listen on port " << opts.port << ": " << std::strerror(errno) << "\n";
+    return 1;
+  }
+  int epfd = ::epoll_create1(EPOLL_CLOEXEC);
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  ::epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev);
+  std::cerr << "torus: serving " << cols << "x" << rows << " on port " << opts.port << "\n";
+
+  Pipeline pipe(opts, rows, cols);
+  WorkerPool pool(opts.threads);
+  TermOutput diff; // frame to frame with --diff, for clients that saw the previous one
+  diff.sync = opts.sync;
+  diff.diff = true;
+  TermOutput full; // for everyone without --diff, otherwise clients that are new or missed a frame
+  full.sync = opts.sync;
+  std::unordered_map<int, Client> clients;
+
+  auto drop = [&](int fd) {
+    ::epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    clients.erase(fd);
+  };
+
+  FrameScheduler scheduler(opts.fps > 0.0 ? opts.fps : SPIN_FPS, opts.skip_frames);
+  epoll_event events[64];
+  char discard[512];
+  while (true) {
+    if (!clients.empty()) {
+      pipe.render(scheduler.frame_time(), pool);
+      std::shared_ptr<const std::string> diff_frame;
+      if (opts.diff) {
+        diff.encode(pipe.fb);
+        diff_frame = std::make_shared<const std::string>(diff.buf);
+      }
+      std::shared_ptr<const std::string> full_frame;
+      for (auto it = clients.begin(); it != clients.end();) {
+        Client &c = it->second;
+        const int fd = it->first;
+        ++it; // drop() erases fd
+        if (c.frame) {
+          c.synced = false; // still busy with an older frame, this one is skipped
+          continue;
+        }
+        if (c.synced && diff_frame) {
+          c.frame = diff_frame;
+        } else {
+          if (!full_frame) {
+            full.encode(pipe.fb);
+            full_frame = std::make_shared<const std::string>(full.buf);
+          }
+          c.frame = full_frame;
+          c.synced = true;
+        }
+        if (!pump_client(epfd, fd, c)) drop(fd);
+      }
+    }
+
+    scheduler.advance();
+    // serve the sockets until the next frame is due
+    while (true) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+          scheduler.deadline() - FrameScheduler::Clock::now());
+      if (left.count() <= 0) break;
+      int n = ::epoll_wait(epfd, events, 64, static_cast<int>(left.count()));
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "torus: epoll_wait failed: " << std::strerror(errno) << "\n";
+        return 1;
+      }
+      for (int k = 0; k < n; k++) {
+        const int fd = events[k].data.fd;
+        if (fd == listen_fd) {
+          int cfd;
+          while ((cfd = ::accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            ::setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            epoll_event cev{};
+            cev.events = EPOLLIN;
+            cev.data.fd = cfd;
+            if (::epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &cev) != 0) {
+              ::close(cfd);
+              continue;
+            }
+            Client &c = clients[cfd];
+            c.prefix = CLEAR_SCREEN;
+            c.prefix_len = sizeof(CLEAR_SCREEN) - 1;
+          }
+          continue;
+        }
+        auto it = clients.find(fd);
+        if (it == clients.end()) continue;
+        bool gone = (events[k].events & (EPOLLERR | EPOLLHUP)) != 0;
+        if (!gone && (events[k].events & EPOLLIN)) {
+          // viewers have nothing to say, anything they type is thrown away
+          ssize_t got = ::recv(fd, discard, sizeof(discard), MSG_DONTWAIT);
+          gone = got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        }
+        if (!gone && (events[k].events & EPOLLOUT)) gone = !pump_client(epfd, fd, it->second);
+        if (gone) drop(fd);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  Options opts = parse_options(argc, argv);
+  if (!opts.kernel.empty()) {
+    ROTATE_KERNEL = rotate_kernel_named(opts.kernel);
+    if (!ROTATE_KERNEL) {
+      std::cerr << argv[0] << ": --kernel " << opts.kernel << " isn't supported on this cpu\n";
+      return 1;
+    }
+  }
+  if (opts.mode == Mode::Bench) {
+    return run_bench(opts);
+  }
+  if (opts.mode == Mode::Headless) {
+    return run_headless(opts);
+  }
+  if (opts.mode == Mode::Serve) {
+    return run_server(opts);
+  }
+  if (!opts.viewports.empty()) {
+    return run_viewports(opts);
+  }
+  struct winsize w{};
+  ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+  int rows, cols;
+  // TIOCGWINSZ leaves zeros when stdout isn't a terminal
+  default_size(opts, w.ws_row > 0 ? w.ws_row : 24, w.ws_col > 0 ? w.ws_col : 80, rows, cols);
+  // not every terminal fills in its pixel size, without one this stays 0 and CELL_ASPECT is used
+  const bool follow_aspect = opts.aspect == 0.0f;
+  if (follow_aspect) opts.aspect = tty_aspect(w);
+  install_resize_handler();
+  if (opts.cycle) {
+    return run_cycle(opts, rows, cols);
+  }
+  // --stats keeps the bottom line for itself
+  auto frame_rows = [&] { return opts.stats ? std::max(1, rows - 1) : rows; };
+  Pipeline pipe(opts, frame_rows(), cols);
+  pipe.prefetch();
+  TermOutput out;
+  out.sync = opts.sync;
+  out.diff = opts.diff;
+  WorkerPool pool(opts.threads);
+  FrameScheduler scheduler(opts.fps, opts.skip_frames);
+  std::optional<AsyncWriter> writer;
+  if (opts.async) writer.emplace(out.fd);
+  Stats stats;
+  install_stats_handlers();
+  while (!g_quit) {
+    if (poll_resize(opts, rows, cols, follow_aspect ? &opts.aspect : nullptr)) {
+      pipe.resize(frame_rows(), cols);
+      pipe.prefetch();
+      out.invalidate();
+    }
+    if (g_dump_stats) {
+      g_dump_stats = 0;
+      stats.dump(STDERR_FILENO);
+    }
+    auto start = std::chrono::steady_clock::now();
+    StageTimes times;
+    pipe.render(scheduler.frame_time(), pool, &times);
+    StageClock clock(&times);
+    if (opts.stats) stats.status_line(cols, out.footer);
+    out.encode(pipe.fb);
+    clock.lap(STAGE_ENCODE);
+    const std::size_t bytes = out.buf.size();
+    if (writer) {
+      writer->submit(out.buf); // with --async, write is the wait for the writer to catch up
+    } else {
+      out.flush();
+    }
+    clock.lap(STAGE_WRITE);
+    stats.add(pipe.counts(), times, bytes, start,
+              std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    scheduler.wait();
   }
+  writer.reset(); // everything queued goes out before the goodbye
+  // leave the prompt below the frame
+  std::string bye;
+  append_at_pos(bye, rows, 1);
+  bye += '\n';
+  write_all(STDOUT_FILENO, bye.data(), bye.size());
+  stats.dump(STDERR_FILENO);
   return 0;
 }